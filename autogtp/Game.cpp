@@ -19,7 +19,7 @@
 #include <QUuid>
 #include "Game.h"
 
-Game::Game(const QString& weights, QTextStream& out) :
+Game::Game(const QString& weights, int threads, QTextStream& out) :
     QProcess(),
     output(out),
     cmdLine("./leelaz"),
@@ -33,7 +33,9 @@ Game::Game(const QString& weights, QTextStream& out) :
 #ifdef WIN32
     cmdLine.append(".exe");
 #endif
-    cmdLine.append(" -g -q -n -d -m 30 -r 0 -w ");
+    cmdLine.append(" -g -q -n -d -m 30 -r 0 -t ");
+    cmdLine.append(QString::number(threads));
+    cmdLine.append(" -w ");
     cmdLine.append(weights);
     cmdLine.append(" -p 1000 --noponder");
     fileName = QUuid::createUuid().toRfc4122().toHex();
@@ -94,12 +96,12 @@ bool Game::sendGtpCommand(QString cmd) {
     return true;
 }
 
-void Game::checkVersion(const VersionTuple &min_version) {
+bool Game::checkVersion(const VersionTuple &min_version) {
     write(qPrintable("version\n"));
     waitForBytesWritten(-1);
     if (!waitReady()) {
         error(Game::LAUNCH_FAILURE);
-        exit(EXIT_FAILURE);
+        return false;
     }
     char readBuffer[256];
     int readCount = readLine(readBuffer, 256);
@@ -107,14 +109,14 @@ void Game::checkVersion(const VersionTuple &min_version) {
     if (readCount <= 3 || readBuffer[0] != '=') {
         output << "GTP: " << readBuffer << endl;
         error(Game::WRONG_GTP);
-        exit(EXIT_FAILURE);
+        return false;
     }
     QString version_buff(&readBuffer[2]);
     version_buff = version_buff.simplified();
     QStringList version_list = version_buff.split(".");
     if (version_list.size() < 2) {
         output << "Unexpected Leela Zero version: " << version_buff << endl;
-        exit(EXIT_FAILURE);
+        return false;
     }
     if (version_list[0].toInt() < std::get<0>(min_version)
         || (version_list[0].toInt() == std::get<0>(min_version)
@@ -125,12 +127,13 @@ void Game::checkVersion(const VersionTuple &min_version) {
                << std::get<1>(min_version) << "." << endl;
         output << "Check https://github.com/gcp/leela-zero for updates."
                 << endl;
-        exit(EXIT_FAILURE);
+        return false;
     }
     if (!eatNewLine()) {
         error(Game::WRONG_GTP);
-        exit(EXIT_FAILURE);
+        return false;
     }
+    return true;
 }
 
 bool Game::gameStart(const VersionTuple &min_version) {
@@ -140,9 +143,13 @@ bool Game::gameStart(const VersionTuple &min_version) {
         return false;
     }
     output << "Engine has started." << endl;
-    // This either succeeds or we exit immediately, so no need to
-    // check any return values.
-    checkVersion(min_version);
+    // Other games may be running on other threads, so a wrong engine
+    // only fails this game instead of exiting.
+    if (!checkVersion(min_version)) {
+        kill();
+        waitForFinished(-1);
+        return false;
+    }
     sendGtpCommand(timeSettings);
     output << "Infinite thinking time set." << endl;
     return true;
@@ -27,7 +27,7 @@ using VersionTuple = std::tuple<int, int>;
 
 class Game : QProcess {
 public:
-    Game(const QString& weights, QTextStream& out);
+    Game(const QString& weights, int threads, QTextStream& out);
     ~Game() = default;
     bool gameStart(const VersionTuple& min_version);
     void move();
@@ -38,6 +38,7 @@ public:
     bool writeSgf();
     bool dumpTraining();
     void gameQuit();
+    QString getFile() const { return fileName; }
 
 private:
     enum {
@@ -58,7 +59,7 @@ private:
     int passes;
     int moveNum;
     bool sendGtpCommand(QString cmd);
-    void checkVersion(const VersionTuple &min_version);
+    bool checkVersion(const VersionTuple &min_version);
     bool waitReady();
     bool eatNewLine();
     void error(int errnum);
@@ -25,8 +25,15 @@
 #include <QFile>
 #include <QDir>
 #include <QDebug>
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "Game.h"
 
 constexpr int AUTOGTP_VERSION = 4;
@@ -48,7 +55,7 @@ bool fetch_best_network_hash(QTextStream& cerr, QString& nethash) {
     QStringList outlst = outstr.split("\n");
     if (outlst.size() != 2) {
         cerr << "Unexpected output from server: " << endl << output << endl;
-        exit(EXIT_FAILURE);
+        return false;
     }
     QString outhash = outlst[0];
     QString client_version = outlst[1];
@@ -57,7 +64,7 @@ bool fetch_best_network_hash(QTextStream& cerr, QString& nethash) {
         cerr << "Server requires client version " << server_expected
              << " but we are version " << AUTOGTP_VERSION << endl;
         cerr << "Check https://github.com/gcp/leela-zero for updates." << endl;
-        exit(EXIT_FAILURE);
+        return false;
     }
     cerr << "Best network hash: " << outhash << endl;
     cerr << "Required client version: " << server_expected << " (OK)" << endl;
@@ -107,58 +114,65 @@ bool fetch_best_network(QTextStream& cerr, QString& netname) {
     return true;
 }
 
-bool upload_data(QTextStream& cerr, const QString& netname, QString sgf_output_path) {
-    // Find output SGF and txt files
+// Games written by an earlier run that never got uploaded
+QStringList find_unsent_games() {
     QDir dir;
     QStringList filters;
     filters << "*.sgf";
     dir.setNameFilters(filters);
     dir.setFilter(QDir::Files | QDir::NoSymLinks);
 
+    QStringList games;
     QFileInfoList list = dir.entryInfoList();
     for (int i = 0; i < list.size(); ++i) {
-        QFileInfo fileInfo = list.at(i);
-        QString sgf_file = fileInfo.fileName();
-        QString data_file = sgf_file;
-        // Save first if requested
-        if (!sgf_output_path.isEmpty()) {
-            QFile(sgf_file).copy(sgf_output_path + '/' + fileInfo.fileName());
-        }
-        // Cut .sgf, add .txt.0.gz
-        data_file.chop(4);
-        data_file += ".txt.0.gz";
-        // Gzip up the sgf too
+        games << list.at(i).completeBaseName();
+    }
+    return games;
+}
+
+bool upload_data(QTextStream& cerr, const QString& netname,
+                 const QString& game_file, QString sgf_output_path) {
+    QDir dir;
+    QString sgf_file = game_file + ".sgf";
+    QString data_file = game_file + ".txt.0.gz";
+    // Save first if requested
+    if (!sgf_output_path.isEmpty()) {
+        QFile(sgf_file).copy(sgf_output_path + '/' + sgf_file);
+    }
+    // Gzip up the sgf too
 #ifdef WIN32
-        QProcess::execute("gzip.exe " + sgf_file);
+    QProcess::execute("gzip.exe " + sgf_file);
 #else
-        QProcess::execute("gzip " + sgf_file);
+    QProcess::execute("gzip " + sgf_file);
 #endif
-        sgf_file += ".gz";
-        QString prog_cmdline("curl");
+    sgf_file += ".gz";
+    QString prog_cmdline("curl");
 #ifdef WIN32
-        prog_cmdline.append(".exe");
+    prog_cmdline.append(".exe");
 #endif
-        prog_cmdline.append(" -F networkhash=" + netname);
-        prog_cmdline.append(" -F clientversion=" + QString::number(AUTOGTP_VERSION));
-        prog_cmdline.append(" -F sgf=@" + sgf_file);
-        prog_cmdline.append(" -F trainingdata=@" + data_file);
-        prog_cmdline.append(" http://zero.sjeng.org/submit");
-        cerr << prog_cmdline << endl;
-        QProcess curl;
-        curl.start(prog_cmdline);
-        curl.waitForFinished(-1);
-        QByteArray output = curl.readAllStandardOutput();
-        QString outstr(output);
-        cerr << outstr;
-        dir.remove(sgf_file);
-        dir.remove(data_file);
-    }
+    prog_cmdline.append(" -F networkhash=" + netname);
+    prog_cmdline.append(" -F clientversion=" + QString::number(AUTOGTP_VERSION));
+    prog_cmdline.append(" -F sgf=@" + sgf_file);
+    prog_cmdline.append(" -F trainingdata=@" + data_file);
+    prog_cmdline.append(" http://zero.sjeng.org/submit");
+    cerr << prog_cmdline << endl;
+    QProcess curl;
+    curl.start(prog_cmdline);
+    curl.waitForFinished(-1);
+    QByteArray output = curl.readAllStandardOutput();
+    QString outstr(output);
+    cerr << outstr;
+    dir.remove(sgf_file);
+    dir.remove(data_file);
     return true;
 }
 
-bool run_one_game(QTextStream& cerr, const QString& weightsname) {
+// game_file is left empty if the game could not be scored and
+// nothing was written.
+bool run_one_game(QTextStream& cerr, const QString& weightsname,
+                  int threads, QString& game_file) {
 
-    Game game(weightsname, cerr);
+    Game game(weightsname, threads, cerr);
     if(!game.gameStart(min_leelaz_version)) {
         return false;
     }
@@ -173,6 +187,7 @@ bool run_one_game(QTextStream& cerr, const QString& weightsname) {
     if (game.getScore()) {
         game.writeSgf();
         game.dumpTraining();
+        game_file = game.getFile();
     }
     cerr << "Stopping engine." << endl;
     game.gameQuit();
@@ -196,6 +211,141 @@ void print_timing_info(QTextStream& cerr, int games_played,
          << game_time_s.count() << " seconds.\n";
 }
 
+// QTextStream is not thread safe, every thread logs through its own.
+void open_log(QFile& log_file, QTextStream& stream) {
+#if defined(LOG_ERRORS_TO_FILE)
+    log_file.setFileName("output.txt");
+    log_file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append);
+    if(!log_file.isOpen()){
+        qDebug() << "- Error, unable to open" << "outputFilename" << "for output";
+    }
+#else
+    log_file.open(stderr, QIODevice::WriteOnly);
+#endif
+    stream.setDevice(&log_file);
+}
+
+// A game waiting to be uploaded and the network that played it
+struct FinishedGame {
+    QString netname;
+    QString game_file;
+};
+
+/*
+    Shared by the game workers and the server thread, guarded by mutex.
+    Every game is started with the network in netname and queued in
+    finished when it is done. The server thread uploads the queued
+    games and switches netname when there is a new best network, so
+    the games never wait on the server.
+*/
+struct SharedState {
+    QMutex mutex;
+    QWaitCondition changed;
+    QString netname;
+    QQueue<FinishedGame> finished;
+    int workers_running{0};
+    // Search threads of every leelaz, the cores split over the games
+    int leelaz_threads{1};
+    bool failed{false};
+    int games_played{0};
+    std::chrono::high_resolution_clock::time_point start;
+};
+
+// Plays games one after the other until one fails
+class GameWorker : public QThread {
+public:
+    GameWorker(SharedState& state) : m_state(state) {}
+
+protected:
+    void run() override {
+        QFile log_file;
+        QTextStream cerr;
+        open_log(log_file, cerr);
+        while (play_game(cerr)) {}
+        QMutexLocker lock(&m_state.mutex);
+        m_state.workers_running--;
+        m_state.changed.wakeAll();
+    }
+
+private:
+    bool play_game(QTextStream& cerr) {
+        auto game_start = std::chrono::high_resolution_clock::now();
+        QString netname;
+        int threads;
+        {
+            QMutexLocker lock(&m_state.mutex);
+            if (m_state.failed) {
+                return false;
+            }
+            netname = m_state.netname;
+            threads = m_state.leelaz_threads;
+        }
+        QString game_file;
+        auto success = run_one_game(cerr, netname, threads, game_file);
+        QMutexLocker lock(&m_state.mutex);
+        if (!success) {
+            m_state.failed = true;
+            return false;
+        }
+        if (!game_file.isEmpty()) {
+            m_state.finished.enqueue({netname, game_file});
+            m_state.changed.wakeAll();
+        }
+        m_state.games_played++;
+        print_timing_info(cerr, m_state.games_played,
+                          m_state.start, game_start);
+        return true;
+    }
+
+    SharedState& m_state;
+};
+
+// Uploads finished games and keeps the best network up to date
+class ServerThread : public QThread {
+public:
+    ServerThread(SharedState& state, const QString& sgf_output_path)
+        : m_state(state), m_sgf_output_path(sgf_output_path) {}
+
+protected:
+    void run() override {
+        QFile log_file;
+        QTextStream cerr;
+        open_log(log_file, cerr);
+        for (;;) {
+            FinishedGame game;
+            {
+                QMutexLocker lock(&m_state.mutex);
+                while (m_state.finished.isEmpty()
+                       && m_state.workers_running > 0) {
+                    m_state.changed.wait(&m_state.mutex);
+                }
+                if (m_state.finished.isEmpty()) {
+                    return;
+                }
+                game = m_state.finished.dequeue();
+            }
+            upload_data(cerr, game.netname, game.game_file,
+                        m_sgf_output_path);
+            // Look for a new network once per game, as before
+            QString netname;
+            auto fetched = fetch_best_network_hash(cerr, netname)
+                           && fetch_best_network(cerr, netname);
+            QMutexLocker lock(&m_state.mutex);
+            if (fetched) {
+                m_state.netname = netname;
+            } else {
+                // The games being played still finish and get uploaded,
+                // no new ones are started.
+                m_state.failed = true;
+            }
+        }
+    }
+
+private:
+    SharedState& m_state;
+    QString m_sgf_output_path;
+};
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
@@ -206,26 +356,23 @@ int main(int argc, char *argv[])
     QCommandLineOption keep_sgf_option(
         { "k", "keep-sgf" }, "Save SGF files after each self-play game.",
                              "output directory");
+    QCommandLineOption games_option(
+        { "g", "games" }, "Number of games to play at the same time.",
+                          "count", "1");
     QCommandLineParser parser;
     parser.addHelpOption();
     parser.addVersionOption();
     parser.addOption(keep_sgf_option);
+    parser.addOption(games_option);
     parser.process(app);
 
     // Map streams
     QTextStream cin(stdin, QIODevice::ReadOnly);
     QTextStream cout(stdout, QIODevice::WriteOnly);
-#if defined(LOG_ERRORS_TO_FILE)
-    // Log stderr to file
-    QFile caFile("output.txt");
-    caFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Append);
-    if(!caFile.isOpen()){
-        qDebug() << "- Error, unable to open" << "outputFilename" << "for output";
-    }
-    QTextStream cerr(&caFile);
-#else
-    QTextStream cerr(stderr, QIODevice::WriteOnly);
-#endif
+    // Log stderr to output.txt with LOG_ERRORS_TO_FILE
+    QFile log_file;
+    QTextStream cerr;
+    open_log(log_file, cerr);
 
     cerr << "autogtp v" << AUTOGTP_VERSION << endl;
 
@@ -237,20 +384,36 @@ int main(int argc, char *argv[])
         }
     }
 
-    auto success = true;
-    auto games_played = 0;
-    auto start = std::chrono::high_resolution_clock::now();
+    auto games = parser.value(games_option).toInt();
+    if (games < 1) {
+        cerr << "Need to play at least one game at a time!" << endl;
+        return EXIT_FAILURE;
+    }
 
-    do {
-        auto game_start = std::chrono::high_resolution_clock::now();
-        QString netname;
-        success &= fetch_best_network_hash(cerr, netname);
-        success &= fetch_best_network(cerr, netname);
-        success &= run_one_game(cerr, netname);
-        success &= upload_data(cerr, netname, parser.value(keep_sgf_option));
-        games_played++;
-        print_timing_info(cerr, games_played, start, game_start);
-    } while (success);
+    SharedState state;
+    state.start = std::chrono::high_resolution_clock::now();
+    if (!fetch_best_network_hash(cerr, state.netname)
+        || !fetch_best_network(cerr, state.netname)) {
+        return EXIT_FAILURE;
+    }
+    for (const auto& game_file : find_unsent_games()) {
+        state.finished.enqueue({state.netname, game_file});
+    }
+    state.workers_running = games;
+    state.leelaz_threads = std::max(1, QThread::idealThreadCount() / games);
+    cerr.flush();
+
+    ServerThread server(state, parser.value(keep_sgf_option));
+    std::vector<std::unique_ptr<GameWorker>> workers;
+    for (auto i = 0; i < games; i++) {
+        workers.emplace_back(std::make_unique<GameWorker>(state));
+        workers.back()->start();
+    }
+    server.start();
+    for (auto& worker : workers) {
+        worker->wait();
+    }
+    server.wait();
 
     cerr.flush();
     cout.flush();
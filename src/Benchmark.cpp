@@ -0,0 +1,217 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "GTP.h"
+#include "Network.h"
+#include "Training.h"
+#include "TTable.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+/*
+    Fixed move sequences, black first. The middle game and endgame
+    continue the opening with random legal moves, so the search sees
+    plenty of fights and captures; they are only meant to be stable
+    between builds, not good Go.
+*/
+const std::vector<Benchmark::Position> Benchmark::s_positions = {
+    {"opening",
+     "Q16 D4 Q3 D16 R5 C14 O17 F17 C6 E3 Q10 K16 K4 R14 R15 Q14"},
+    // black has just taken the ko at K10, white may not retake
+    {"ko",
+     "Q16 D4 Q3 D16 R5 C14 O17 F17 C6 E3 Q10 K16 K4 R14 R15 Q14 "
+     "K9 L9 J10 K10 K11 M10 R10 L11 L10"},
+    {"middlegame",
+     "Q16 D4 Q3 D16 R5 C14 O17 F17 C6 E3 Q10 K16 K4 R14 R15 Q14 "
+     "C1 A6 O10 S15 P10 P15 J14 C13 M17 L6 H9 K13 B7 B5 F11 A8 "
+     "T3 F13 F7 L4 D14 A5 R7 T1 R6 Q4 J15 Q15 D7 L17 P4 D11 "
+     "Q1 L2 L10 Q2 P2 H1 B6 N16 J16 T17 A16 K11 R11 N6 Q9 P5 "
+     "K3 D12 R9 Q18 H17 J18 C19 O12 K18 T2 C17 O9 T7 N2 P14 G10 "
+     "C4 F1 C9 S2 C5 N18 D6 M14 B4 O3 H6 P8 M11 L3 G19 C3 "
+     "Q5 S11 F4 E1 K1 M7 F12 L19 S14 P6 O7 G5 Q8 O16 O13 S17 "
+     "S5 E18 D8 D15 L11 E16 Q17 J12"},
+    {"endgame",
+     "Q16 D4 Q3 D16 R5 C14 O17 F17 C6 E3 Q10 K16 K4 R14 R15 Q14 "
+     "H19 B6 E19 G9 G15 H5 A9 O3 S3 Q12 T4 H17 B9 H7 S8 G17 "
+     "F9 N10 J7 B4 C1 N11 C2 D1 S4 O5 M2 A3 P16 C10 O13 P14 "
+     "B15 L19 P3 A15 L13 L8 F10 P17 O14 P19 R8 C12 E11 H10 N9 B19 "
+     "S5 C15 M6 D19 Q8 M9 G14 T19 B10 T11 L3 N5 N13 F1 D10 B14 "
+     "L15 L11 K9 K18 K7 L7 C19 J14 P1 R10 O11 K2 G12 C18 M16 J9 "
+     "G4 B2 G7 T9 J16 S18 A16 N6 Q15 D6 S9 L12 F8 A14 C7 T13 "
+     "C11 P2 E1 C17 H11 S12 K13 K12 A13 J17 P11 F2 F15 T10 P15 L16 "
+     "O12 H16 P13 N14 O4 O7 K14 B11 S13 M17 E16 P8 N3 D12 L14 K11 "
+     "G11 N18 O1 P9 M3 R7 M8 C9 K15 D18 H2 T2 E12 H3 N8 M4 "
+     "N1 B13 E4 T1 C8 O2 R3 F4 A6 A2 O6 J11 Q18 R17 Q4 L2 "
+     "R13 S10 R11 O9 D5 E10 M1 P7 O8 E9 K6 L10 S15 A4 A10 O10 "
+     "N2 N12 J15 T12 D15 Q9 Q19 R12 S11 H15 R16 T6 Q1 F5 Q6 D2 "
+     "T8 T7 H13 M11 B18 R6 T5 G18 T18 C16 R1 M18 C4 N16 O16 T15 "
+     "L1 M7 Q17 B1 P12 H6"},
+};
+
+static std::string json_escape(const std::string& str) {
+    auto res = std::string{};
+    for (auto c : str) {
+        if (c == '"' || c == '\\') {
+            res.push_back('\\');
+        }
+        res.push_back(c);
+    }
+    return res;
+}
+
+GameState Benchmark::setup_position(const Position& pos) {
+    GameState state;
+    state.init_game(19, 7.5f);
+    // Long enough that only the playout limit ends a search.
+    state.set_timecontrol(24 * 60 * 60 * 100, 0, 0, 0);
+
+    std::istringstream moves(pos.moves);
+    std::string vertex;
+    while (moves >> vertex) {
+        // play_textmove wants lowercase columns
+        std::transform(begin(vertex), end(vertex), begin(vertex), ::tolower);
+        auto color = state.get_to_move() == FastBoard::BLACK ? "b" : "w";
+        auto success = state.play_textmove(color, vertex);
+        assert(success);
+        (void)success;
+    }
+    return state;
+}
+
+float Benchmark::nn_evals_per_second(GameState& state) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NN_EVALS; i++) {
+        Network::get_scored_moves(&state, Network::Ensemble::RANDOM_ROTATION);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto seconds = std::chrono::duration<double>(end - start).count();
+    return (float)(NN_EVALS / seconds);
+}
+
+void Benchmark::run(int max_threads, int playouts) {
+    struct Totals {
+        int threads;
+        int playouts;
+        int nodes;
+        double seconds;
+    };
+
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.emplace_back(threads);
+    }
+    thread_counts.emplace_back(max_threads);
+
+    std::vector<Totals> totals;
+    for (auto threads : thread_counts) {
+        totals.emplace_back(Totals{threads, 0, 0, 0.0});
+    }
+
+    printf("{\n");
+    printf("  \"version\": \"%s\",\n", PROGRAM_VERSION);
+    printf("  \"weights\": \"%s\",\n", json_escape(cfg_weightsfile).c_str());
+    printf("  \"playouts\": %d,\n", playouts);
+    printf("  \"positions\": [\n");
+
+    for (size_t p = 0; p < s_positions.size(); p++) {
+        auto& pos = s_positions[p];
+        auto state = setup_position(pos);
+
+        myprintf("Benchmarking %s position...\n", pos.name.c_str());
+        auto nn_evals = nn_evals_per_second(state);
+
+        printf("    {\n");
+        printf("      \"name\": \"%s\",\n", pos.name.c_str());
+        printf("      \"move_number\": %zu,\n", state.get_movenum());
+        printf("      \"nn_evals_per_sec\": %.1f,\n", nn_evals);
+        printf("      \"search\": [\n");
+
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            auto threads = thread_counts[t];
+            myprintf("  searching %d playouts with %d thread(s)\n",
+                     playouts, threads);
+
+            // Start every search cold and keep its output off the console.
+            TTable::get_TT()->clear();
+            auto search_state = setup_position(pos);
+            auto search = std::make_unique<UCTSearch>(search_state);
+            search->set_playout_limit(playouts);
+
+            auto old_threads = cfg_num_threads;
+            auto old_quiet = cfg_quiet;
+            cfg_num_threads = threads;
+            cfg_quiet = true;
+
+            auto start = std::chrono::steady_clock::now();
+            search->think(search_state.get_to_move());
+            auto end = std::chrono::steady_clock::now();
+
+            cfg_num_threads = old_threads;
+            cfg_quiet = old_quiet;
+            Training::clear_training();
+
+            auto seconds = std::chrono::duration<double>(end - start).count();
+            auto done_playouts = search->get_playouts();
+            auto done_nodes = search->get_nodes();
+            totals[t].playouts += done_playouts;
+            totals[t].nodes += done_nodes;
+            totals[t].seconds += seconds;
+
+            printf("        {\"threads\": %d, \"playouts\": %d, \"nodes\": %d, "
+                   "\"time_to_move_ms\": %.1f, \"playouts_per_sec\": %.1f, "
+                   "\"nodes_per_sec\": %.1f}%s\n",
+                   threads, done_playouts, done_nodes, seconds * 1000.0,
+                   done_playouts / seconds, done_nodes / seconds,
+                   t + 1 < thread_counts.size() ? "," : "");
+        }
+
+        printf("      ]\n");
+        printf("    }%s\n", p + 1 < s_positions.size() ? "," : "");
+    }
+
+    printf("  ],\n");
+    printf("  \"totals\": [\n");
+    for (size_t t = 0; t < totals.size(); t++) {
+        auto& total = totals[t];
+        printf("    {\"threads\": %d, \"playouts_per_sec\": %.1f, "
+               "\"nodes_per_sec\": %.1f, \"speedup\": %.2f}%s\n",
+               total.threads,
+               total.playouts / total.seconds,
+               total.nodes / total.seconds,
+               (total.playouts / total.seconds)
+                   / (totals[0].playouts / totals[0].seconds),
+               t + 1 < totals.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
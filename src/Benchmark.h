@@ -0,0 +1,52 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARK_H_INCLUDED
+#define BENCHMARK_H_INCLUDED
+
+#include "config.h"
+#include <string>
+#include <vector>
+#include "GameState.h"
+
+class Benchmark {
+public:
+    /*
+        Measure network and search speed on a fixed set of positions
+        and write the results to stdout as a single JSON object.
+        Searches are repeated with 1, 2, 4, ... up to max_threads threads.
+    */
+    static void run(int max_threads, int playouts);
+
+    // Network evaluations timed per position.
+    static constexpr int NN_EVALS = 400;
+    // Playouts per search when none are given on the command line.
+    static constexpr int DEFAULT_PLAYOUTS = 1600;
+
+private:
+    struct Position {
+        std::string name;
+        std::string moves;
+    };
+    static const std::vector<Position> s_positions;
+
+    static GameState setup_position(const Position& pos);
+    static float nn_evals_per_second(GameState& state);
+};
+
+#endif
@@ -0,0 +1,266 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "ChunkFormat.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <boost/utility/string_ref.hpp>
+#include "zlib.h"
+
+namespace ChunkFormat {
+
+static uint32 read_le32(const char* data) {
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    return uint32(bytes[0])
+         | uint32(bytes[1]) << 8
+         | uint32(bytes[2]) << 16
+         | uint32(bytes[3]) << 24;
+}
+
+static bool get_bit(const uint8* plane, size_t point) {
+    return (plane[point / 8] >> (point % 8)) & 1;
+}
+
+std::string binary_header() {
+    auto header = std::string{BINARY_MAGIC};
+    for (auto value : {BINARY_VERSION, uint32(BINARY_RECORD_SIZE)}) {
+        for (auto byte = 0; byte < 4; byte++) {
+            header.push_back(char((value >> (8 * byte)) & 0xFF));
+        }
+    }
+    assert(header.size() == BINARY_HEADER_SIZE);
+    return header;
+}
+
+std::string encode_text(const Record& record) {
+    constexpr auto points = size_t{19 * 19};
+    auto out = std::stringstream{};
+    // First output 16 times an input feature plane
+    for (auto p = size_t{0}; p < HISTORY_PLANES; p++) {
+        auto plane = &record.planes[p * PLANE_BYTES];
+        // Write it out as a string of hex characters
+        for (auto bit = size_t{0}; bit + 3 < points; bit += 4) {
+            auto hexbyte =  get_bit(plane, bit)     << 3
+                          | get_bit(plane, bit + 1) << 2
+                          | get_bit(plane, bit + 2) << 1
+                          | get_bit(plane, bit + 3) << 0;
+            out << std::hex << hexbyte;
+        }
+        // 361 % 4 = 1 so the last bit goes by itself
+        out << get_bit(plane, points - 1);
+        out << std::dec << std::endl;
+    }
+    // The side to move planes can be compactly encoded into a single
+    // bit, 0 = black to move.
+    out << (record.to_move == 0 ? "0" : "1") << std::endl;
+    // Then a 362 long array of float probabilities
+    for (auto it = begin(record.probabilities);
+        it != end(record.probabilities); ++it) {
+        out << *it;
+        if (std::next(it) != end(record.probabilities)) {
+            out << " ";
+        }
+    }
+    out << std::endl;
+    // And the game result for the side to move
+    out << (record.winner == 1 ? "1" : "-1") << std::endl;
+    return out.str();
+}
+
+std::string encode_binary(const Record& record) {
+    auto out = std::string(BINARY_RECORD_SIZE, '\0');
+    std::copy(begin(record.planes), end(record.planes), begin(out));
+    auto pos = record.planes.size();
+    out[pos++] = char(record.to_move);
+    out[pos++] = char(record.winner);
+    for (auto prob : record.probabilities) {
+        prob = std::min(std::max(prob, 0.0f), 1.0f);
+        auto scaled = uint16(std::lround(prob * 65535.0f));
+        out[pos++] = char(scaled & 0xFF);
+        out[pos++] = char(scaled >> 8);
+    }
+    assert(pos == out.size());
+    return out;
+}
+
+/*
+    Parse the lines of a text record. Returns false if the record is
+    malformed.
+*/
+static bool decode_text(const std::vector<boost::string_ref>& lines,
+                        Record& record) {
+    record.planes.fill(0);
+    for (auto p = size_t{0}; p < HISTORY_PLANES; p++) {
+        const auto& line = lines[p];
+        auto plane = &record.planes[p * PLANE_BYTES];
+        // 90 hex characters for the first 360 bits, then the last bit
+        if (line.size() < 91) {
+            return false;
+        }
+        for (auto i = size_t{0}; i < 90; i++) {
+            auto c = line[i];
+            int hexbyte;
+            if (c >= '0' && c <= '9') {
+                hexbyte = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                hexbyte = c - 'a' + 10;
+            } else {
+                return false;
+            }
+            // The first bit of a hex character is the most significant
+            for (auto bit = size_t{0}; bit < 4; bit++) {
+                if (hexbyte & (8 >> bit)) {
+                    auto point = i * 4 + bit;
+                    plane[point / 8] |= uint8(1 << (point % 8));
+                }
+            }
+        }
+        if (line[90] == '1') {
+            plane[360 / 8] |= uint8(1 << (360 % 8));
+        } else if (line[90] != '0') {
+            return false;
+        }
+    }
+    if (lines[16].empty() || (lines[16][0] != '0' && lines[16][0] != '1')) {
+        return false;
+    }
+    record.to_move = uint8(lines[16][0] - '0');
+
+    // The line is followed by a newline, so strtof stops in time.
+    auto probs = lines[17].data();
+    auto probs_end = probs + lines[17].size();
+    for (auto& prob : record.probabilities) {
+        char* next;
+        prob = std::strtof(probs, &next);
+        // Work around a bug in leela-zero v0.3
+        if (next == probs || next > probs_end || std::isnan(prob)) {
+            return false;
+        }
+        probs = next;
+    }
+    while (probs < probs_end && std::isspace(*probs)) {
+        probs++;
+    }
+    if (probs != probs_end) {
+        return false;
+    }
+
+    if (lines[18] == "1") {
+        record.winner = 1;
+    } else if (lines[18] == "-1") {
+        record.winner = -1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool decode_binary(const char* data, Record& record) {
+    std::copy(data, data + record.planes.size(), begin(record.planes));
+    auto pos = record.planes.size();
+    record.to_move = uint8(data[pos++]);
+    record.winner = int8(data[pos++]);
+    if (record.to_move > 1 || (record.winner != 1 && record.winner != -1)) {
+        return false;
+    }
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+    for (auto& prob : record.probabilities) {
+        auto scaled = uint16(bytes[pos] | bytes[pos + 1] << 8);
+        prob = scaled / 65535.0f;
+        pos += 2;
+    }
+    return true;
+}
+
+size_t decode_chunk(const std::string& contents,
+                    std::vector<Record>& records, size_t* skipped) {
+    auto record = Record{};
+    auto decoded = size_t{0};
+    auto malformed = size_t{0};
+    if (contents.compare(0, 4, BINARY_MAGIC) == 0) {
+        if (contents.size() < BINARY_HEADER_SIZE
+            || read_le32(&contents[4]) != BINARY_VERSION
+            || read_le32(&contents[8]) != BINARY_RECORD_SIZE) {
+            throw std::runtime_error("Unsupported binary chunk");
+        }
+        for (auto pos = BINARY_HEADER_SIZE;
+             pos + BINARY_RECORD_SIZE <= contents.size();
+             pos += BINARY_RECORD_SIZE) {
+            if (decode_binary(&contents[pos], record)) {
+                records.emplace_back(record);
+                decoded++;
+            } else {
+                malformed++;
+            }
+        }
+    } else {
+        auto text = boost::string_ref{contents};
+        auto lines = std::vector<boost::string_ref>{};
+        while (!text.empty()) {
+            auto eol = std::min(text.find('\n'), text.size());
+            auto line = text.substr(0, eol);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            lines.emplace_back(line);
+            text.remove_prefix(std::min(eol + 1, text.size()));
+            if (lines.size() == TEXT_RECORD_LINES) {
+                if (decode_text(lines, record)) {
+                    records.emplace_back(record);
+                    decoded++;
+                } else {
+                    malformed++;
+                }
+                lines.clear();
+            }
+        }
+    }
+    if (skipped) {
+        *skipped += malformed;
+    }
+    return decoded;
+}
+
+std::string read_chunk(const std::string& filename) {
+    // gzread also reads files that aren't compressed
+    auto in = gzopen(filename.c_str(), "rb");
+    if (!in) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    auto contents = std::string{};
+    auto buffer = std::make_unique<char[]>(1 << 16);
+    auto bytes = 0;
+    while ((bytes = gzread(in, buffer.get(), 1 << 16)) > 0) {
+        contents.append(buffer.get(), bytes);
+    }
+    gzclose(in);
+    if (bytes < 0) {
+        throw std::runtime_error("Error reading " + filename);
+    }
+    return contents;
+}
+
+}
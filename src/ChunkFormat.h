@@ -0,0 +1,84 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKFORMAT_H_INCLUDED
+#define CHUNKFORMAT_H_INCLUDED
+
+#include "config.h"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+    The training chunks as they are on disk, written by OutputChunker
+    and read back by Training and the loader in training/loader.
+
+    Text chunks are the line based format described in the README.
+
+    Binary chunks start with a header: the magic "LZTB", the format
+    version and the record size, each 4 bytes little endian. Fixed size
+    records follow, so record n starts at BINARY_HEADER_SIZE +
+    n * BINARY_RECORD_SIZE in the uncompressed chunk. A record is
+    - 16 input planes, 361 bits each, padded to 46 bytes
+    - 1 byte side to move, 0 = black, 1 = white
+    - 1 byte signed game result for the side to move, 1 or -1
+    - 362 search probabilities, 2 bytes little endian each, scaled
+      so that 65535 = 1.0, pass last
+*/
+namespace ChunkFormat {
+    constexpr auto BINARY_MAGIC = "LZTB";
+    constexpr uint32 BINARY_VERSION = 1;
+    constexpr size_t BINARY_HEADER_SIZE = 12;
+    constexpr size_t HISTORY_PLANES = 16;
+    constexpr size_t PLANE_BYTES = (19 * 19 + 7) / 8;
+    constexpr size_t POLICY_OUTPUTS = 19 * 19 + 1;
+    constexpr size_t BINARY_RECORD_SIZE =
+        HISTORY_PLANES * PLANE_BYTES + 2 + POLICY_OUTPUTS * 2;
+    // 16 planes, 1 side to move, 1 x 362 probabilities, 1 winner
+    constexpr size_t TEXT_RECORD_LINES = HISTORY_PLANES + 1 + 1 + 1;
+
+    /*
+        A decoded record. The planes use the bit layout of the binary
+        format, point n is bit n % 8 of byte n / 8.
+    */
+    struct Record {
+        std::array<uint8, HISTORY_PLANES * PLANE_BYTES> planes;
+        uint8 to_move;
+        int8 winner;
+        std::array<float, POLICY_OUTPUTS> probabilities;
+    };
+
+    std::string binary_header();
+    std::string encode_text(const Record& record);
+    std::string encode_binary(const Record& record);
+
+    /*
+        Append the records in a chunk, text or binary. Malformed records
+        are skipped and counted in skipped, if given. Returns the number
+        of records appended.
+    */
+    size_t decode_chunk(const std::string& contents,
+                        std::vector<Record>& records,
+                        size_t* skipped = nullptr);
+
+    // The uncompressed contents of a chunk file
+    std::string read_chunk(const std::string& filename);
+}
+
+#endif
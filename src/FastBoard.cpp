@@ -95,6 +95,7 @@ void FastBoard::set_square(int vertex, FastBoard::square_t content) {
     assert(content >= BLACK && content <= INVAL);
 
     m_square[vertex] = content;
+    m_empty_mask[vertex] = (content == EMPTY);
 }
 
 FastBoard::square_t FastBoard::get_square(int x, int y) const {
@@ -151,7 +152,6 @@ void FastBoard::reset_board(int size) {
     m_prisoners[WHITE] = 0;
     m_totalstones[BLACK] = 0;
     m_totalstones[WHITE] = 0;
-    m_empty_cnt = 0;
 
     m_dirs[0] = -size-2;
     m_dirs[1] = +1;
@@ -172,14 +172,15 @@ void FastBoard::reset_board(int size) {
         m_neighbours[i] = 0;
         m_parent[i]     = MAXSQ;
     }
+    m_empty_mask.reset();
+    m_closed_mask.reset();
 
     for (int i = 0; i < size; i++) {
         for (int j = 0; j < size; j++) {
             int vertex = get_vertex(i, j);
 
             m_square[vertex]          = EMPTY;
-            m_empty_idx[vertex]       = m_empty_cnt;
-            m_empty[m_empty_cnt++]    = vertex;
+            m_empty_mask.set(vertex);
 
             if (i == 0 || i == size - 1) {
                 m_neighbours[vertex] += (1 << (NBR_SHIFT * BLACK))
@@ -196,11 +197,13 @@ void FastBoard::reset_board(int size) {
             } else {
                 m_neighbours[vertex] +=  2 << (NBR_SHIFT * EMPTY);
             }
+
+            m_closed_mask[vertex] = count_pliberties(vertex) == 0;
         }
     }
 
     m_parent[MAXSQ] = MAXSQ;
-    m_libs[MAXSQ]   = 16384;    /* we will subtract from this */
+    m_strings[MAXSQ].libs   = 16384;    /* we will subtract from this */
     m_next[MAXSQ]   = MAXSQ;
 }
 
@@ -214,7 +217,7 @@ bool FastBoard::is_suicide(int i, int color) {
     for (int k = 0; k < 4; k++) {
         int ai = i + m_dirs[k];
 
-        int libs = m_libs[m_parent[ai]];
+        int libs = m_strings[m_parent[ai]].libs;
         if (get_square(ai) == color) {
             if (libs > 1) {
                 // connecting to live group = never suicide
@@ -237,7 +240,7 @@ bool FastBoard::is_suicide(int i, int color) {
     for (int k = 0; k < 4; k++) {
         int ai = i + m_dirs[k];
 
-        int libs = m_libs[m_parent[ai]];
+        int libs = m_strings[m_parent[ai]].libs;
 
         if (libs == 0 && get_square(ai) != color) {
             opps_live = false;
@@ -271,10 +274,10 @@ int FastBoard::fast_ss_suicide(const int color, const int i)  {
 
     if (!eyeplay) return false;
 
-    if (m_libs[m_parent[i - 1              ]] <= 1) return false;
-    if (m_libs[m_parent[i + 1              ]] <= 1) return false;
-    if (m_libs[m_parent[i + m_boardsize + 2]] <= 1) return false;
-    if (m_libs[m_parent[i - m_boardsize - 2]] <= 1) return false;
+    if (m_strings[m_parent[i - 1              ]].libs <= 1) return false;
+    if (m_strings[m_parent[i + 1              ]].libs <= 1) return false;
+    if (m_strings[m_parent[i + m_boardsize + 2]].libs <= 1) return false;
+    if (m_strings[m_parent[i - m_boardsize - 2]].libs <= 1) return false;
 
     return true;
 }
@@ -289,6 +292,7 @@ void FastBoard::add_neighbour(const int i, const int color) {
         int ai = i + m_dirs[k];
 
         m_neighbours[ai] += (1 << (NBR_SHIFT * color)) - (1 << (NBR_SHIFT * EMPTY));
+        m_closed_mask[ai] = count_pliberties(ai) == 0;
 
         bool found = false;
         for (int i = 0; i < nbr_par_cnt; i++) {
@@ -298,7 +302,7 @@ void FastBoard::add_neighbour(const int i, const int color) {
             }
         }
         if (!found) {
-            m_libs[m_parent[ai]]--;
+            m_strings[m_parent[ai]].libs--;
             nbr_pars[nbr_par_cnt++] = m_parent[ai];
         }
     }
@@ -315,6 +319,7 @@ void FastBoard::remove_neighbour(const int i, const int color) {
 
         m_neighbours[ai] += (1 << (NBR_SHIFT * EMPTY))
                           - (1 << (NBR_SHIFT * color));
+        m_closed_mask[ai] = count_pliberties(ai) == 0;
 
         bool found = false;
         for (int i = 0; i < nbr_par_cnt; i++) {
@@ -324,7 +329,7 @@ void FastBoard::remove_neighbour(const int i, const int color) {
             }
         }
         if (!found) {
-            m_libs[m_parent[ai]]++;
+            m_strings[m_parent[ai]].libs++;
             nbr_pars[nbr_par_cnt++] = m_parent[ai];
         }
     }
@@ -341,15 +346,12 @@ int FastBoard::remove_string_fast(int i) {
         assert(m_square[pos] == color);
 
         m_square[pos]  = EMPTY;
+        m_empty_mask.set(pos);
         m_parent[pos]  = MAXSQ;
         m_totalstones[color]--;
 
         remove_neighbour(pos, color);
 
-        m_empty_idx[pos]     = m_empty_cnt;
-        m_empty[m_empty_cnt] = pos;
-        m_empty_cnt++;
-
         removed++;
         pos = m_next[pos];
     } while (pos != i);
@@ -357,61 +359,43 @@ int FastBoard::remove_string_fast(int i) {
     return removed;
 }
 
-std::vector<bool> FastBoard::calc_reach_color(int col) {
-    auto bd = std::vector<bool>(m_maxsq);
-    auto last = std::vector<bool>(m_maxsq);
-
-    std::fill(begin(bd), end(bd), false);
-    std::fill(begin(last), end(last), false);
+FastBoard::movemask_t FastBoard::calc_reach_color(int col) const {
+    auto reach = movemask_t{};
+    auto empty = movemask_t{};
 
-    /* needs multi pass propagation, slow */
-    do {
-        last = bd;
-        for (int i = 0; i < m_boardsize; i++) {
-            for (int j = 0; j < m_boardsize; j++) {
-                int vertex = get_vertex(i, j);
-                /* colored field, spread */
-                if (m_square[vertex] == col) {
-                    bd[vertex] = true;
-                    for (int k = 0; k < 4; k++) {
-                        if (m_square[vertex + m_dirs[k]] == EMPTY) {
-                            bd[vertex + m_dirs[k]] = true;
-                        }
-                    }
-                } else if (m_square[vertex] == EMPTY && bd[vertex]) {
-                    for (int k = 0; k < 4; k++) {
-                        if (m_square[vertex + m_dirs[k]] == EMPTY) {
-                            bd[vertex + m_dirs[k]] = true;
-                        }
-                    }
-                }
-            }
+    for (int vertex = 0; vertex < m_maxsq; vertex++) {
+        if (m_square[vertex] == col) {
+            reach.set(vertex);
+        } else if (m_square[vertex] == EMPTY) {
+            empty.set(vertex);
         }
-    } while (last != bd);
+    }
 
-    return bd;
+    /*
+        flood fill from the stones through empty squares, a whole
+        board at a time; the border squares stop the row shifts
+        from wrapping around
+    */
+    const int row = m_boardsize + 2;
+    auto last = movemask_t{};
+    while (reach != last) {
+        last = reach;
+        reach |= ((last << 1) | (last >> 1)
+                  | (last << row) | (last >> row)) & empty;
+    }
+
+    return reach;
 }
 
 // Needed for scoring passed out games not in MC playouts
-float FastBoard::area_score(float komi) {
+float FastBoard::area_score(float komi) const {
     auto white = calc_reach_color(WHITE);
     auto black = calc_reach_color(BLACK);
 
-    auto score = -komi;
+    auto bsc = (black & ~white).count();
+    auto wsc = (white & ~black).count();
 
-    for (int i = 0; i < m_boardsize; i++) {
-        for (int j = 0; j < m_boardsize; j++) {
-            auto vertex = get_vertex(i, j);
-
-            if (white[vertex] && !black[vertex]) {
-                score -= 1.0f;
-            } else if (black[vertex] && !white[vertex]) {
-                score += 1.0f;
-            }
-        }
-    }
-
-    return score;
+    return (float)bsc - (float)wsc - komi;
 }
 
 int FastBoard::get_stone_count() {
@@ -429,15 +413,14 @@ int FastBoard::estimate_mc_score(float komi) {
 
 float FastBoard::final_mc_score(float komi) {
     int wsc, bsc;
-    int maxempty = m_empty_cnt;
 
     bsc = m_totalstones[BLACK];
     wsc = m_totalstones[WHITE];
 
-    for (int v = 0; v < maxempty; v++) {
-        int i = m_empty[v];
-
-        assert(m_square[i] == EMPTY);
+    for (int i = 0; i < m_maxsq; i++) {
+        if (m_square[i] != EMPTY) {
+            continue;
+        }
 
         int allblack = ((m_neighbours[i] >> (NBR_SHIFT * BLACK)) & 7) == 4;
         int allwhite = ((m_neighbours[i] >> (NBR_SHIFT * WHITE)) & 7) == 4;
@@ -513,11 +496,11 @@ void FastBoard::display_liberties(int lastmove) {
             myprintf(" ");
         for (int i = 0; i < boardsize; i++) {
             if (get_square(i,j) == WHITE) {
-                int libs = m_libs[m_parent[get_vertex(i,j)]];
+                int libs = m_strings[m_parent[get_vertex(i,j)]].libs;
                 if (libs > 9) { libs = 9; };
                 myprintf("%1d", libs);
             } else if (get_square(i,j) == BLACK)  {
-                int libs = m_libs[m_parent[get_vertex(i,j)]];
+                int libs = m_strings[m_parent[get_vertex(i,j)]].libs;
                 if (libs > 9) { libs = 9; };
                 myprintf("%1d", libs);
             } else if (starpoint(boardsize, i, j)) {
@@ -569,7 +552,7 @@ void FastBoard::merge_strings(const int ip, const int aip) {
     assert(ip != MAXSQ && aip != MAXSQ);
 
     /* merge stones */
-    m_stones[ip] += m_stones[aip];
+    m_strings[ip].stones += m_strings[aip].stones;
 
     /* loop over stones, update parents */
     int newpos = aip;
@@ -593,7 +576,7 @@ void FastBoard::merge_strings(const int ip, const int aip) {
                 }
 
                 if (!found) {
-                    m_libs[ip]++;
+                    m_strings[ip].libs++;
                 }
             }
         }
@@ -610,10 +593,11 @@ void FastBoard::merge_strings(const int ip, const int aip) {
 
 int FastBoard::update_board_eye(const int color, const int i) {
     m_square[i]  = (square_t)color;
+    m_empty_mask.reset(i);
     m_next[i]    = i;
     m_parent[i]  = i;
-    m_libs[i]    = 0;
-    m_stones[i]  = 1;
+    m_strings[i].libs    = 0;
+    m_strings[i].stones  = 1;
     m_totalstones[color]++;
 
     add_neighbour(i, color);
@@ -626,18 +610,13 @@ int FastBoard::update_board_eye(const int color, const int i) {
 
         assert(ai >= 0 && ai <= m_maxsq);
 
-        if (m_libs[m_parent[ai]] <= 0) {
+        if (m_strings[m_parent[ai]].libs <= 0) {
             int this_captured    = remove_string_fast(ai);
             captured_sq          = ai;
             captured_stones     += this_captured;
         }
     }
 
-    /* move last vertex in list to our position */
-    int lastvertex               = m_empty[--m_empty_cnt];
-    m_empty_idx[lastvertex]      = m_empty_idx[i];
-    m_empty[m_empty_idx[i]]      = lastvertex;
-
     m_prisoners[color] += captured_stones;
 
     // possibility of ko
@@ -667,10 +646,11 @@ int FastBoard::update_board_fast(const int color, const int i, bool & capture) {
     }
 
     m_square[i]  = (square_t)color;
+    m_empty_mask.reset(i);
     m_next[i]    = i;
     m_parent[i]  = i;
-    m_libs[i]    = count_pliberties(i);
-    m_stones[i]  = 1;
+    m_strings[i].libs    = count_pliberties(i);
+    m_strings[i].stones  = 1;
     m_totalstones[color]++;
 
     add_neighbour(i, color);
@@ -683,7 +663,7 @@ int FastBoard::update_board_fast(const int color, const int i, bool & capture) {
         assert(ai >= 0 && ai <= m_maxsq);
 
         if (m_square[ai] == !color) {
-            if (m_libs[m_parent[ai]] <= 0) {
+            if (m_strings[m_parent[ai]].libs <= 0) {
                 capture = true;
                 m_prisoners[color] += remove_string_fast(ai);
             }
@@ -692,7 +672,7 @@ int FastBoard::update_board_fast(const int color, const int i, bool & capture) {
             int aip = m_parent[ai];
 
             if (ip != aip) {
-                if (m_stones[ip] >= m_stones[aip]) {
+                if (m_strings[ip].stones >= m_strings[aip].stones) {
                     merge_strings(ip, aip);
                 } else {
                     merge_strings(aip, ip);
@@ -701,15 +681,10 @@ int FastBoard::update_board_fast(const int color, const int i, bool & capture) {
         }
     }
 
-    /* move last vertex in list to our position */
-    int lastvertex               = m_empty[--m_empty_cnt];
-    m_empty_idx[lastvertex]      = m_empty_idx[i];
-    m_empty[m_empty_idx[i]]      = lastvertex;
-
-    assert(m_libs[m_parent[i]] < m_boardsize*m_boardsize);
+    assert(m_strings[m_parent[i]].libs < m_boardsize*m_boardsize);
 
     /* check whether we still live (i.e. detect suicide) */
-    if (m_libs[m_parent[i]] == 0) {
+    if (m_strings[m_parent[i]].libs == 0) {
         remove_string_fast(i);
     }
 
@@ -897,7 +872,7 @@ std::vector<int> FastBoard::get_string_stones(int vertex) {
     int start = m_parent[vertex];
 
     std::vector<int> res;
-    res.reserve(m_stones[start]);
+    res.reserve(m_strings[start].stones);
 
     int newpos = start;
 
@@ -928,10 +903,10 @@ std::string FastBoard::get_string(int vertex) {
 }
 
 bool FastBoard::fast_in_atari(int vertex) {
-    assert((m_square[vertex] < EMPTY) || (m_libs[m_parent[vertex]] > MAXSQ));
+    assert((m_square[vertex] < EMPTY) || (m_strings[m_parent[vertex]].libs > MAXSQ));
 
     int par = m_parent[vertex];
-    int lib = m_libs[par];
+    int lib = m_strings[par].libs;
 
     return lib == 1;
 }
@@ -941,11 +916,11 @@ bool FastBoard::fast_in_atari(int vertex) {
 int FastBoard::in_atari(int vertex) {
     assert(m_square[vertex] < EMPTY);
 
-    if (m_libs[m_parent[vertex]] > 1) {
+    if (m_strings[m_parent[vertex]].libs > 1) {
         return false;
     }
 
-    assert(m_libs[m_parent[vertex]] == 1);
+    assert(m_strings[m_parent[vertex]].libs == 1);
 
     int pos = vertex;
 
@@ -997,7 +972,7 @@ int FastBoard::string_size(int vertex) {
     assert(vertex > 0 && vertex < m_maxsq);
     assert(m_square[vertex] == WHITE || m_square[vertex] == BLACK);
 
-    return m_stones[m_parent[vertex]];
+    return m_strings[m_parent[vertex]].stones;
 }
 
 int FastBoard::count_rliberties(int vertex) {
@@ -1025,7 +1000,7 @@ int FastBoard::count_rliberties(int vertex) {
     } while (pos != vertex);
 
     return liberties;*/
-    return m_libs[m_parent[vertex]];
+    return m_strings[m_parent[vertex]].libs;
 }
 
 int FastBoard::merged_string_size(int color, int vertex) {
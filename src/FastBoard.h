@@ -22,9 +22,9 @@
 #include "config.h"
 
 #include <array>
+#include <bitset>
 #include <string>
 #include <vector>
-#include <queue>
 
 class FastBoard {
     friend class FastState;
@@ -71,6 +71,10 @@ public:
     */
     using movescore_t = std::pair<int, float>;
     using scoredmoves_t = std::vector<movescore_t>;
+    /*
+        set of vertices, indexed by vertex number
+    */
+    using movemask_t = std::bitset<MAXSQ>;
 
     int get_boardsize(void) const;
     square_t get_square(int x, int y) const;
@@ -96,8 +100,8 @@ public:
     int estimate_mc_score(float komi);
     float final_mc_score(float komi);
     int get_stone_count();
-    float area_score(float komi);
-    std::vector<bool> calc_reach_color(int col);
+    float area_score(float komi) const;
+    movemask_t calc_reach_color(int col) const;
 
     int get_prisoners(int side);
     bool black_to_move();
@@ -126,20 +130,26 @@ protected:
     static const std::array<int,      2> s_eyemask;
     static const std::array<square_t, 4> s_cinvert; /* color inversion */
 
+    /*
+        what is kept per string, side by side as they are mostly
+        looked at together
+    */
+    struct string_t {
+        unsigned short libs;    /* liberties */
+        unsigned short stones;  /* stones */
+    };
+
     std::array<square_t, MAXSQ>            m_square;      /* board contents */
     std::array<unsigned short, MAXSQ+1>    m_next;        /* next stone in string */
     std::array<unsigned short, MAXSQ+1>    m_parent;      /* parent node of string */
-    std::array<unsigned short, MAXSQ+1>    m_libs;        /* liberties per string parent */
-    std::array<unsigned short, MAXSQ+1>    m_stones;      /* stones per string parent */
+    std::array<string_t, MAXSQ+1>          m_strings;     /* per string parent */
     std::array<unsigned short, MAXSQ>      m_neighbours;  /* counts of neighboring stones */
+    movemask_t                             m_empty_mask;  /* empty squares */
+    movemask_t                             m_closed_mask; /* no empty neighbours */
     std::array<int, 4>                     m_dirs;        /* movement directions 4 way */
     std::array<int, 8>                     m_extradirs;   /* movement directions 8 way */
     std::array<int, 2>                     m_prisoners;   /* prisoners per color */
     std::array<int, 2>                     m_totalstones; /* stones per color */
-    std::vector<int>                       m_critical;    /* queue of critical points */
-    std::array<unsigned short, MAXSQ>      m_empty;       /* empty squares */
-    std::array<unsigned short, MAXSQ>      m_empty_idx;   /* indexes of square */
-    int m_empty_cnt;                                      /* count of empties */
 
     int m_tomove;
     int m_maxsq;
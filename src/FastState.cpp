@@ -66,21 +66,29 @@ void FastState::reset_board(void) {
     board.reset_board(board.get_boardsize());
 }
 
-std::vector<int> FastState::generate_moves(int color) {
-    std::vector<int> result;
-
-    result.reserve(board.m_empty_cnt);
-
-    for (int i = 0; i < board.m_empty_cnt; i++) {
-        int vertex = board.m_empty[i];
+/*
+    Legal moves for color as a vertex mask: every empty square except
+    the ko point and suicides. Passing is always legal and is not part
+    of the mask.
+*/
+FastBoard::movemask_t FastState::generate_moves(int color) {
+    auto result = board.m_empty_mask;
+    if (m_komove >= 0) {
+        result.reset(m_komove);
+    }
 
-        if (vertex != m_komove && !board.is_suicide(vertex, color)) {
-            result.push_back(vertex);
+    // Only a point without an empty neighbour can be a suicide
+    auto closed = result & board.m_closed_mask;
+    auto to_probe = closed.count();
+    for (int vertex = 0; to_probe > 0; vertex++) {
+        if (closed[vertex]) {
+            to_probe--;
+            if (board.is_suicide(vertex, color)) {
+                result.reset(vertex);
+            }
         }
     }
 
-    result.push_back(+FastBoard::PASS);
-
     return result;
 }
 
@@ -209,18 +217,16 @@ std::string FastState::move_to_text(int move) {
 }
 
 std::vector<int> FastState::final_score_map() {
-    FastState workstate(*this);
-
-    std::vector<bool> white = workstate.board.calc_reach_color(FastBoard::WHITE);
-    std::vector<bool> black = workstate.board.calc_reach_color(FastBoard::BLACK);
+    auto white = board.calc_reach_color(FastBoard::WHITE);
+    auto black = board.calc_reach_color(FastBoard::BLACK);
 
     std::vector<int> res;
     res.resize(FastBoard::MAXSQ);
     std::fill(res.begin(), res.end(), FastBoard::EMPTY);
 
-    for (int i = 0; i < workstate.board.get_boardsize(); i++) {
-        for (int j = 0; j < workstate.board.get_boardsize(); j++) {
-            int vertex = workstate.board.get_vertex(i, j);
+    for (int i = 0; i < board.get_boardsize(); i++) {
+        for (int j = 0; j < board.get_boardsize(); j++) {
+            int vertex = board.get_vertex(i, j);
 
             if (white[vertex] && !black[vertex]) {
                 res[vertex] = FastBoard::WHITE;
@@ -234,8 +240,7 @@ std::vector<int> FastState::final_score_map() {
 }
 
 float FastState::final_score() {
-    FastState workstate(*this);
-    return workstate.board.area_score(get_komi() + get_handicap());
+    return board.area_score(get_komi() + get_handicap());
 }
 
 float FastState::get_komi() const {
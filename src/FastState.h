@@ -33,7 +33,7 @@ public:
     void play_pass(void);
     void play_move(int vertex);
 
-    std::vector<int> generate_moves(int color);
+    FastBoard::movemask_t generate_moves(int color);
 
     void set_komi(float komi);
     float get_komi() const;
@@ -18,6 +18,7 @@
 
 #include <cassert>
 #include <algorithm>
+#include <type_traits>
 
 #include "config.h"
 
@@ -27,6 +28,13 @@
 
 using namespace Utils;
 
+/*
+    states are copied on every search descent and history entry,
+    so a board must stay a single flat block without heap members
+*/
+static_assert(std::is_trivially_copyable<FullBoard>::value,
+              "FullBoard must be trivially copyable");
+
 int FullBoard::remove_string(int i) {
     int pos = i;
     int removed = 0;
@@ -35,17 +43,15 @@ int FullBoard::remove_string(int i) {
     do {
         hash    ^= Zobrist::zobrist[m_square[pos]][pos];
         ko_hash ^= Zobrist::zobrist[m_square[pos]][pos];
+        update_sym_hashes(pos, color, EMPTY);
 
         m_square[pos] = EMPTY;
+        m_empty_mask.set(pos);
         m_parent[pos] = MAXSQ;
         m_totalstones[color]--;
 
         remove_neighbour(pos, color);
 
-        m_empty_idx[pos]      = m_empty_cnt;
-        m_empty[m_empty_cnt]  = pos;
-        m_empty_cnt++;
-
         hash    ^= Zobrist::zobrist[m_square[pos]][pos];
         ko_hash ^= Zobrist::zobrist[m_square[pos]][pos];
 
@@ -108,24 +114,42 @@ uint64 FullBoard::calc_hash(void) {
     return res;
 }
 
-std::array<uint64, 8> FullBoard::get_rotated_hashes(void) {
-    std::array<uint64, 8> result;
+void FullBoard::calc_sym_hashes(void) {
+    const auto& symkeys = Zobrist::zobrist_sym[m_boardsize];
 
     for (int sym = 0; sym < 8; sym++) {
         uint64 res = 0x1234567887654321ULL;
 
         for (int i = 0; i < m_maxsq; i++) {
             if (m_square[i] != INVAL) {
-                int newi = rotate_vertex(i, sym);
-                res ^= Zobrist::zobrist[m_square[i]][newi];
+                res ^= symkeys[sym][m_square[i]][i];
             }
         }
-        /* prisoner hashing is rule set dependent */
-        res ^= Zobrist::zobrist_pris[0][m_prisoners[0]];
-        res ^= Zobrist::zobrist_pris[1][m_prisoners[1]];
-        if (m_tomove == BLACK)
-           res ^= 0xABCDABCDABCDABCDULL;
-        result[sym] = res;
+        sym_hash[sym] = res;
+    }
+}
+
+void FullBoard::update_sym_hashes(int vertex, int oldcolor, int newcolor) {
+    const auto& symkeys = Zobrist::zobrist_sym[m_boardsize];
+
+    for (int sym = 0; sym < 8; sym++) {
+        sym_hash[sym] ^= symkeys[sym][oldcolor][vertex]
+                       ^ symkeys[sym][newcolor][vertex];
+    }
+}
+
+std::array<uint64, 8> FullBoard::get_rotated_hashes(void) {
+    std::array<uint64, 8> result;
+
+    /* prisoner hashing is rule set dependent */
+    uint64 extra = Zobrist::zobrist_pris[0][m_prisoners[0]]
+                 ^ Zobrist::zobrist_pris[1][m_prisoners[1]];
+    if (m_tomove == BLACK) {
+        extra ^= 0xABCDABCDABCDABCDULL;
+    }
+
+    for (int sym = 0; sym < 8; sym++) {
+        result[sym] = sym_hash[sym] ^ extra;
     }
 
     return result;
@@ -149,12 +173,14 @@ int FullBoard::update_board(const int color, const int i, bool &capture) {
 
     hash ^= Zobrist::zobrist[m_square[i]][i];
     ko_hash ^= Zobrist::zobrist[m_square[i]][i];
+    update_sym_hashes(i, EMPTY, color);
 
     m_square[i] = (square_t)color;
+    m_empty_mask.reset(i);
     m_next[i] = i;
     m_parent[i] = i;
-    m_libs[i] = count_pliberties(i);
-    m_stones[i] = 1;
+    m_strings[i].libs = count_pliberties(i);
+    m_strings[i].stones = 1;
     m_totalstones[color]++;
 
     hash ^= Zobrist::zobrist[m_square[i]][i];
@@ -173,7 +199,7 @@ int FullBoard::update_board(const int color, const int i, bool &capture) {
         int ai = i + m_dirs[k];
 
         if (m_square[ai] == !color) {
-            if (m_libs[m_parent[ai]] <= 0) {
+            if (m_strings[m_parent[ai]].libs <= 0) {
                 int this_captured = remove_string(ai);
                 captured_sq = ai;
                 captured_stones += this_captured;
@@ -183,7 +209,7 @@ int FullBoard::update_board(const int color, const int i, bool &capture) {
             int aip = m_parent[ai];
 
             if (ip != aip) {
-                if (m_stones[ip] >= m_stones[aip]) {
+                if (m_strings[ip].stones >= m_strings[aip].stones) {
                     merge_strings(ip, aip);
                 } else {
                     merge_strings(aip, ip);
@@ -196,13 +222,8 @@ int FullBoard::update_board(const int color, const int i, bool &capture) {
     m_prisoners[color] += captured_stones;
     hash ^= Zobrist::zobrist_pris[color][m_prisoners[color]];
 
-    /* move last vertex in list to our position */
-    int lastvertex = m_empty[--m_empty_cnt];
-    m_empty_idx[lastvertex] = m_empty_idx[i];
-    m_empty[m_empty_idx[i]] = lastvertex;
-
     /* check whether we still live (i.e. detect suicide) */
-    if (m_libs[m_parent[i]] == 0) {
+    if (m_strings[m_parent[i]].libs == 0) {
         assert(captured_stones == 0);
         remove_string_fast(i);
     }
@@ -229,4 +250,5 @@ void FullBoard::reset_board(int size) {
 
     calc_hash();
     calc_ko_hash();
+    calc_sym_hashes();
 }
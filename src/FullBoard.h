@@ -29,9 +29,12 @@ public:
 
     uint64 calc_hash(void);
     uint64 calc_ko_hash(void);
+    void calc_sym_hashes(void);
     uint64 get_hash(void);
     uint64 get_ko_hash(void);
     uint64 get_canonical_hash(void);
+    // the hash under each of the 8 symmetries
+    std::array<uint64, 8> get_rotated_hashes(void);
 
     // calculates hash after move without executing it
     // good for calculating superko
@@ -42,9 +45,11 @@ public:
 
     uint64 hash;
     uint64 ko_hash;
+    /* stone-only hashes of the 8 board symmetries */
+    std::array<uint64, 8> sym_hash;
 
 private:
-    std::array<uint64, 8> get_rotated_hashes(void);
+    void update_sym_hashes(int vertex, int oldcolor, int newcolor);
 };
 
 #endif
@@ -43,12 +43,15 @@ using namespace Utils;
 // Configuration flags
 bool cfg_allow_pondering;
 int cfg_num_threads;
+bool cfg_numa;
+int cfg_nn_threads;
 int cfg_max_playouts;
 int cfg_lagbuffer_cs;
 int cfg_resignpct;
 int cfg_noise;
 int cfg_random_cnt;
 bool cfg_dumbpass;
+int cfg_compression;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
 int cfg_rowtiles;
@@ -65,11 +68,14 @@ bool cfg_quiet;
 void GTP::setup_default_parameters() {
     cfg_allow_pondering = true;
     cfg_num_threads = std::max(1, std::min(SMP::get_num_cpus(), MAX_CPUS));
+    cfg_numa = false;
+    cfg_nn_threads = 1;
     cfg_max_playouts = std::numeric_limits<decltype(cfg_max_playouts)>::max();
     cfg_lagbuffer_cs = 100;
 #ifdef USE_OPENCL
     cfg_gpus = { };
-    cfg_rowtiles = 5;
+    // 0 leaves the row tiles to the OpenCL tuner
+    cfg_rowtiles = 0;
 #endif
     cfg_puct = 2.8f;
     cfg_softmax_temp = 1.0f;
@@ -79,6 +85,7 @@ void GTP::setup_default_parameters() {
     cfg_noise = false;
     cfg_random_cnt = 0;
     cfg_dumbpass = false;
+    cfg_compression = OutputChunker::DEFAULT_COMPRESSION_LEVEL;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
 }
@@ -111,6 +118,7 @@ const std::string GTP::s_commands[] = {
     "kgs-time_settings",
     "kgs-game_over",
     "heatmap",
+    "lz-search_stats",
     ""
 };
 
@@ -651,6 +659,10 @@ bool GTP::execute(GameState & game, std::string xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
         return true;
+    } else if (command.find("lz-search_stats") == 0) {
+        auto stats = UCTSearch::get_last_stats();
+        gtp_printf(id, "\n%s", stats.c_str());
+        return true;
     } else if (command.find("netbench") == 0) {
         Network::benchmark(&game);
         gtp_printf(id, "");
@@ -677,7 +689,7 @@ bool GTP::execute(GameState & game, std::string xinput) {
         return true;
     } else if (command.find("dump_training") == 0) {
         std::istringstream cmdstream(command);
-        std::string tmp, winner_color, filename;
+        std::string tmp, winner_color, filename, format;
         int who_won;
 
         // tmp will eat "dump_training"
@@ -692,28 +704,108 @@ bool GTP::execute(GameState & game, std::string xinput) {
             return true;
         }
 
-        Training::dump_training(who_won, filename);
-
-        if (!cmdstream.fail()) {
-            gtp_printf(id, "");
-        } else {
+        if (cmdstream.fail()) {
             gtp_fail_printf(id, "syntax not understood");
+            return true;
         }
 
+        // Optional, "binary" for the binary training format
+        auto training_format = TrainingFormat::TEXT;
+        if (cmdstream >> format) {
+            if (format != "binary") {
+                gtp_fail_printf(id, "syntax not understood");
+                return true;
+            }
+            training_format = TrainingFormat::BINARY;
+        }
+
+        Training::dump_training(who_won, filename, training_format,
+                                cfg_compression);
+        gtp_printf(id, "");
+
         return true;
     } else if (command.find("dump_supervised") == 0) {
         std::istringstream cmdstream(command);
-        std::string tmp, winner_color, sgfname, outname;
+        std::string tmp, winner_color, sgfname, outname, format;
 
         // tmp will eat dump_supervised
         cmdstream >> tmp >> sgfname >> outname;
 
-        Training::dump_supervised(sgfname, outname);
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
 
-        if (!cmdstream.fail()) {
+        auto training_format = TrainingFormat::TEXT;
+        if (cmdstream >> format) {
+            if (format != "binary") {
+                gtp_fail_printf(id, "syntax not understood");
+                return true;
+            }
+            training_format = TrainingFormat::BINARY;
+        }
+
+        Training::dump_supervised(sgfname, outname, training_format,
+                                  cfg_compression);
+        gtp_printf(id, "");
+
+        return true;
+    } else if (command.find("convert_training") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, inname, outname;
+
+        // tmp will eat convert_training
+        cmdstream >> tmp >> inname >> outname;
+
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+
+        try {
+            auto converted = Training::convert_to_binary(inname, outname,
+                                                         cfg_compression);
+            myprintf("Converted %d training positions.\n", int(converted));
             gtp_printf(id, "");
-        } else {
+        } catch (const std::exception& e) {
+            gtp_fail_printf(id, "%s", e.what());
+        }
+
+        return true;
+    } else if (command.find("dedup_training") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, outname, inname;
+        int max_copies;
+
+        // tmp will eat dedup_training
+        cmdstream >> tmp >> max_copies >> outname;
+
+        if (cmdstream.fail()) {
             gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+
+        auto innames = std::vector<std::string>{};
+        while (cmdstream >> inname) {
+            innames.emplace_back(inname);
+        }
+        auto training_format = TrainingFormat::TEXT;
+        if (!innames.empty() && innames.back() == "binary") {
+            training_format = TrainingFormat::BINARY;
+            innames.pop_back();
+        }
+
+        if (innames.empty() || max_copies < 1) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        }
+
+        try {
+            Training::dedup_training(innames, outname, max_copies,
+                                     training_format, cfg_compression);
+            gtp_printf(id, "");
+        } catch (const std::exception& e) {
+            gtp_fail_printf(id, "%s", e.what());
         }
 
         return true;
@@ -25,12 +25,15 @@
 
 extern bool cfg_allow_pondering;
 extern int cfg_num_threads;
+extern bool cfg_numa;
+extern int cfg_nn_threads;
 extern int cfg_max_playouts;
 extern int cfg_lagbuffer_cs;
 extern int cfg_resignpct;
 extern int cfg_noise;
 extern int cfg_random_cnt;
 extern bool cfg_dumbpass;
+extern int cfg_compression;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern int cfg_rowtiles;
@@ -81,6 +81,13 @@ bool GameState::undo_move(void) {
     }
 }
 
+const KoState* GameState::get_past_state(int moves_ago) const {
+    if (moves_ago < 0 || size_t(moves_ago) > m_movenum) {
+        return nullptr;
+    }
+    return game_history[m_movenum - moves_ago].get();
+}
+
 void GameState::rewind(void) {
     *(static_cast<KoState*>(this)) = *game_history[0];
     m_movenum = 0;
@@ -47,6 +47,9 @@ public:
     void rewind(void); /* undo infinite */
     bool undo_move(void);
     bool forward_move(void);
+    // The position moves_ago moves back, nullptr if that is before
+    // the start of the game history.
+    const KoState* get_past_state(int moves_ago) const;
 
     void play_move(int color, int vertex);
     void play_move(int vertex);
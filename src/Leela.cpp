@@ -26,6 +26,8 @@
 #include <boost/format.hpp>
 #include "Network.h"
 
+#include "Benchmark.h"
+#include "SelfPlay.h"
 #include "Zobrist.h"
 #include "GTP.h"
 #include "SMP.h"
@@ -44,7 +46,9 @@ void license_blurb() {
     );
 }
 
-void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
+void parse_commandline(int argc, char *argv[], bool & gtp_mode,
+                       bool & benchmark_mode, int & selfplay_games,
+                       int & selfplay_total, std::string & selfplay_prefix) {
     namespace po = boost::program_options;
     // Declare the supported options.
     po::options_description v_desc("Allowed options");
@@ -69,11 +73,32 @@ void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("noponder", "Disable thinking on opponent's time.")
+#ifndef USE_OPENCL
+        ("nnthreads", po::value<int>()->default_value(cfg_nn_threads),
+                      "Number of threads splitting up each network "
+                      "evaluation.")
+#endif
+        ("numa", "Pin search threads to CPUs, node by node, and keep "
+                 "a copy of the network weights on every NUMA node.")
+        ("benchmark", "Measure speed on built-in positions, "
+                      "print results as JSON and exit.")
+        ("selfplay", po::value<int>(),
+                     "Play # games against ourselves at the same time "
+                     "and write out the training data.")
+        ("selfplay_games", po::value<int>()->default_value(0),
+                           "Stop self-play after # games, 0 = never.")
+        ("selfplay_prefix",
+         po::value<std::string>()->default_value("selfplay"),
+         "Prefix for the self-play training chunks and SGF file.")
+        ("compression", po::value<int>()->default_value(cfg_compression),
+                        "gzip level of the training data written, "
+                        "1 (fastest) to 9 (smallest).")
 #ifdef USE_OPENCL
         ("gpu",  po::value<std::vector<int> >(),
                 "ID of the OpenCL device(s) to use (disables autodetection).")
-        ("rowtiles", po::value<int>()->default_value(cfg_rowtiles),
-                     "Split up the board in # tiles.")
+        ("rowtiles", po::value<int>(),
+                     "Split up the board in # tiles "
+                     "(default: tuned for the device).")
 #endif
 #ifdef USE_TUNER
         ("puct", po::value<float>())
@@ -166,10 +191,27 @@ void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
         }
     }
 
+#ifndef USE_OPENCL
+    if (vm.count("nnthreads")) {
+        int nn_threads = vm["nnthreads"].as<int>();
+        nn_threads = std::min(MAX_CPUS, nn_threads);
+        nn_threads = std::max(1, nn_threads);
+        if (nn_threads != cfg_nn_threads) {
+            myprintf("Using %d thread(s) per network evaluation.\n",
+                     nn_threads);
+            cfg_nn_threads = nn_threads;
+        }
+    }
+#endif
+
     if (vm.count("noponder")) {
         cfg_allow_pondering = false;
     }
 
+    if (vm.count("numa")) {
+        cfg_numa = true;
+    }
+
     if (vm.count("noise")) {
         cfg_noise = true;
     }
@@ -180,7 +222,7 @@ void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
 
     if (vm.count("playouts")) {
         cfg_max_playouts = vm["playouts"].as<int>();
-        if (!vm.count("noponder")) {
+        if (!vm.count("noponder") && !vm.count("benchmark")) {
             myprintf("Nonsensical options: Playouts are restricted but "
                      "thinking on the opponent's time is still allowed. "
                      "Add --noponder if you want a weakened engine.\n");
@@ -188,6 +230,30 @@ void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
         }
     }
 
+    if (vm.count("benchmark")) {
+        benchmark_mode = true;
+        if (!vm.count("playouts")) {
+            cfg_max_playouts = Benchmark::DEFAULT_PLAYOUTS;
+        }
+    }
+
+    if (vm.count("selfplay")) {
+        selfplay_games = std::max(1, vm["selfplay"].as<int>());
+        selfplay_total = std::max(0, vm["selfplay_games"].as<int>());
+        selfplay_prefix = vm["selfplay_prefix"].as<std::string>();
+        if (!vm.count("playouts") || !vm.count("noponder")) {
+            myprintf("Self-play needs a playout limit and --noponder.\n");
+            exit(EXIT_FAILURE);
+        }
+        // The search output of concurrent games would be interleaved
+        cfg_quiet = true;
+    }
+
+    if (vm.count("compression")) {
+        int compression = vm["compression"].as<int>();
+        cfg_compression = std::min(9, std::max(1, compression));
+    }
+
     if (vm.count("resignpct")) {
         cfg_resignpct = vm["resignpct"].as<int>();
     }
@@ -223,11 +289,16 @@ void parse_commandline(int argc, char *argv[], bool & gtp_mode) {
 
 int main (int argc, char *argv[]) {
     bool gtp_mode = false;
+    bool benchmark_mode = false;
+    int selfplay_games = 0;
+    int selfplay_total = 0;
+    std::string selfplay_prefix;
     std::string input;
 
     // Set up engine parameters
     GTP::setup_default_parameters();
-    parse_commandline(argc, argv, gtp_mode);
+    parse_commandline(argc, argv, gtp_mode, benchmark_mode,
+                      selfplay_games, selfplay_total, selfplay_prefix);
 
     // Disable IO buffering as much as possible
     std::cout.setf(std::ios::unitbuf);
@@ -240,11 +311,29 @@ int main (int argc, char *argv[]) {
     setbuf(stdin, NULL);
 #endif
 
-    if (!gtp_mode) {
+    // The benchmark writes JSON to stdout, keep it clean
+    if (!gtp_mode && !benchmark_mode) {
         license_blurb();
     }
 
-    thread_pool.initialize(cfg_num_threads);
+    // Every self-play game searches with cfg_num_threads threads
+    auto pool_threads = cfg_num_threads * std::max(1, selfplay_games);
+    if (cfg_numa) {
+        // The main thread searches too, it takes the first slot.
+        if (SMP::bind_thread(0)) {
+            myprintf("Pinning %d thread(s) over %d NUMA node(s).\n",
+                     pool_threads, (int)SMP::get_numa_nodes().size());
+            thread_pool.initialize(pool_threads, [](size_t i) {
+                SMP::bind_thread(int(i) + 1);
+            });
+        } else {
+            myprintf("Thread pinning is not supported on this platform.\n");
+            cfg_numa = false;
+            thread_pool.initialize(pool_threads);
+        }
+    } else {
+        thread_pool.initialize(pool_threads);
+    }
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -252,6 +341,20 @@ int main (int argc, char *argv[]) {
 
     // Initialize network
     Network::initialize();
+    // Every search thread has at most one evaluation waiting
+    Network::start_batching(pool_threads);
+    std::atexit(Network::stop_batching);
+
+    if (benchmark_mode) {
+        Benchmark::run(cfg_num_threads, cfg_max_playouts);
+        return 0;
+    }
+
+    if (selfplay_games > 0) {
+        SelfPlay::run(selfplay_games, selfplay_total, selfplay_prefix,
+                      cfg_compression);
+        return 0;
+    }
 
     auto maingame = std::make_unique<GameState>();
 
@@ -26,6 +26,11 @@
 #include <memory>
 #include <cmath>
 #include <array>
+#include <chrono>
+#include <deque>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
 #include <thread>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
@@ -52,36 +57,103 @@
 #include "Random.h"
 #include "Network.h"
 #include "GTP.h"
+#include "SMP.h"
 #include "Utils.h"
 
 using namespace Utils;
 
 // Input + residual block tower
-std::vector<std::vector<float>> conv_weights;
-std::vector<std::vector<float>> conv_biases;
-std::vector<std::vector<float>> batchnorm_means;
-std::vector<std::vector<float>> batchnorm_variances;
+struct TowerWeights {
+    std::vector<std::vector<float>> conv_weights;
+    std::vector<std::vector<float>> conv_biases;
+    std::vector<std::vector<float>> batchnorm_means;
+    std::vector<std::vector<float>> batchnorm_variances;
+};
+
+TowerWeights tower_weights;
+
+// Threads helping out with a single evaluation, see --nnthreads.
+// With --numa every node has its own, pinned to it.
+static ThreadPool nn_pool;
+static std::vector<std::unique_ptr<ThreadPool>> node_nn_pools;
+
+static ThreadPool & get_nn_pool() {
+    auto node = SMP::get_thread_node();
+    if (node >= 0 && size_t(node) < node_nn_pools.size()) {
+        return *node_nn_pools[node];
+    }
+    return nn_pool;
+}
+
+// Policy and value heads
+struct HeadWeights {
+    // Policy head
+    std::vector<float> conv_pol_w;
+    std::vector<float> conv_pol_b;
+    std::array<float, 2> bn_pol_w1;
+    std::array<float, 2> bn_pol_w2;
+
+    std::array<float, 261364> ip_pol_w;
+    std::array<float, 362> ip_pol_b;
+
+    // Value head
+    std::vector<float> conv_val_w;
+    std::vector<float> conv_val_b;
+    std::array<float, 1> bn_val_w1;
+    std::array<float, 1> bn_val_w2;
 
-// Policy head
-std::vector<float> conv_pol_w;
-std::vector<float> conv_pol_b;
-std::array<float, 2> bn_pol_w1;
-std::array<float, 2> bn_pol_w2;
+    std::array<float, 92416> ip1_val_w;
+    std::array<float, 256> ip1_val_b;
 
-std::array<float, 261364> ip_pol_w;
-std::array<float, 362> ip_pol_b;
+    std::array<float, 256> ip2_val_w;
+    std::array<float, 1> ip2_val_b;
+};
 
-// Value head
-std::vector<float> conv_val_w;
-std::vector<float> conv_val_b;
-std::array<float, 1> bn_val_w1;
-std::array<float, 1> bn_val_w2;
+HeadWeights head_weights;
 
-std::array<float, 92416> ip1_val_w;
-std::array<float, 256> ip1_val_b;
+// rotate_nn_idx for every symmetry and vertex
+static std::array<std::array<int, 19 * 19>, 8> rotation_table;
 
-std::array<float, 256> ip2_val_w;
-std::array<float, 1> ip2_val_b;
+#ifndef USE_OPENCL
+// With --numa, a copy of the weights allocated on every node
+std::vector<std::unique_ptr<TowerWeights>> node_tower_weights;
+std::vector<std::unique_ptr<HeadWeights>> node_head_weights;
+
+static const TowerWeights & get_tower_weights() {
+    auto node = SMP::get_thread_node();
+    if (node >= 0 && size_t(node) < node_tower_weights.size()) {
+        return *node_tower_weights[node];
+    }
+    return tower_weights;
+}
+
+static const HeadWeights & get_head_weights() {
+    auto node = SMP::get_thread_node();
+    if (node >= 0 && size_t(node) < node_head_weights.size()) {
+        return *node_head_weights[node];
+    }
+    return head_weights;
+}
+
+static void replicate_weights() {
+    auto nodes = SMP::get_numa_nodes().size();
+    if (nodes < 2) {
+        return;
+    }
+    node_tower_weights.resize(nodes);
+    node_head_weights.resize(nodes);
+    for (auto node = size_t{0}; node < nodes; node++) {
+        // Copy from a thread on the node, so first touch places the
+        // pages there.
+        std::thread([node]() {
+            SMP::bind_thread_to_node(int(node));
+            node_tower_weights[node] = std::make_unique<TowerWeights>(tower_weights);
+            node_head_weights[node] = std::make_unique<HeadWeights>(head_weights);
+        }).join();
+    }
+    myprintf("Network weights copied to %d NUMA nodes.\n", int(nodes));
+}
+#endif
 
 void Network::benchmark(GameState * state) {
     {
@@ -95,9 +167,8 @@ void Network::benchmark(GameState * state) {
         for (int i = 0; i < cpus; i++) {
             tg.add_task([iters_per_thread, state]() {
                 GameState mystate = *state;
-                for (int loop = 0; loop < iters_per_thread; loop++) {
-                    auto vec = get_scored_moves(&mystate, Ensemble::RANDOM_ROTATION);
-                }
+                std::vector<GameState*> states(iters_per_thread, &mystate);
+                auto vec = get_scored_moves(states, Ensemble::RANDOM_ROTATION);
             });
         };
         tg.wait_all();
@@ -112,9 +183,17 @@ void Network::benchmark(GameState * state) {
 }
 
 void Network::initialize(void) {
+    for (auto symmetry = 0; symmetry < 8; symmetry++) {
+        for (auto vertex = 0; vertex < 19 * 19; vertex++) {
+            rotation_table[symmetry][vertex] =
+                rotate_nn_idx(vertex, symmetry);
+        }
+    }
+
 #ifdef USE_OPENCL
     myprintf("Initializing OpenCL\n");
     opencl.initialize();
+#endif
 
     // Count size of the network
     myprintf("Detecting residual layers...");
@@ -156,7 +235,7 @@ void Network::initialize(void) {
         exit(EXIT_FAILURE);
     }
     residual_blocks /= 8;
-    myprintf("%d blocks\nTransferring weights to GPU...", residual_blocks);
+    myprintf("%d blocks\n", residual_blocks);
 
     // Re-read file and process
     wtfile.clear();
@@ -177,47 +256,55 @@ void Network::initialize(void) {
         }
         if (linecount < plain_conv_wts) {
             if (linecount % 4 == 0) {
-                conv_weights.emplace_back(weights);
+                tower_weights.conv_weights.emplace_back(weights);
             } else if (linecount % 4 == 1) {
-                conv_biases.emplace_back(weights);
+                tower_weights.conv_biases.emplace_back(weights);
             } else if (linecount % 4 == 2) {
-                batchnorm_means.emplace_back(weights);
+                tower_weights.batchnorm_means.emplace_back(weights);
             } else if (linecount % 4 == 3) {
-                batchnorm_variances.emplace_back(weights);
+                tower_weights.batchnorm_variances.emplace_back(weights);
             }
         } else if (linecount == plain_conv_wts) {
-            conv_pol_w = std::move(weights);
+            head_weights.conv_pol_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 1) {
-            conv_pol_b = std::move(weights);
+            head_weights.conv_pol_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 2) {
-            std::copy(begin(weights), end(weights), begin(bn_pol_w1));
+            std::copy(begin(weights), end(weights), begin(head_weights.bn_pol_w1));
         } else if (linecount == plain_conv_wts + 3) {
-            std::copy(begin(weights), end(weights), begin(bn_pol_w2));
+            std::copy(begin(weights), end(weights), begin(head_weights.bn_pol_w2));
         } else if (linecount == plain_conv_wts + 4) {
-            std::copy(begin(weights), end(weights), begin(ip_pol_w));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip_pol_w));
         } else if (linecount == plain_conv_wts + 5) {
-            std::copy(begin(weights), end(weights), begin(ip_pol_b));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip_pol_b));
         } else if (linecount == plain_conv_wts + 6) {
-            conv_val_w = std::move(weights);
+            head_weights.conv_val_w = std::move(weights);
         } else if (linecount == plain_conv_wts + 7) {
-            conv_val_b = std::move(weights);
+            head_weights.conv_val_b = std::move(weights);
         } else if (linecount == plain_conv_wts + 8) {
-            std::copy(begin(weights), end(weights), begin(bn_val_w1));
+            std::copy(begin(weights), end(weights), begin(head_weights.bn_val_w1));
         } else if (linecount == plain_conv_wts + 9) {
-            std::copy(begin(weights), end(weights), begin(bn_val_w2));
+            std::copy(begin(weights), end(weights), begin(head_weights.bn_val_w2));
         } else if (linecount == plain_conv_wts + 10) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_w));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip1_val_w));
         } else if (linecount == plain_conv_wts + 11) {
-            std::copy(begin(weights), end(weights), begin(ip1_val_b));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip1_val_b));
         } else if (linecount == plain_conv_wts + 12) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_w));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip2_val_w));
         } else if (linecount == plain_conv_wts + 13) {
-            std::copy(begin(weights), end(weights), begin(ip2_val_b));
+            std::copy(begin(weights), end(weights), begin(head_weights.ip2_val_b));
         }
         linecount++;
     }
     wtfile.close();
 
+#ifdef USE_OPENCL
+    myprintf("Transferring weights to GPU...");
+
+    const auto & conv_weights = tower_weights.conv_weights;
+    const auto & conv_biases = tower_weights.conv_biases;
+    const auto & batchnorm_means = tower_weights.batchnorm_means;
+    const auto & batchnorm_variances = tower_weights.batchnorm_variances;
+
     // input
     size_t weight_index = 0;
     opencl_net.push_convolve(3, conv_weights[weight_index],
@@ -238,8 +325,51 @@ void Network::initialize(void) {
                                     batchnorm_variances[weight_index + 1]);
         weight_index += 2;
     }
+
+    // heads
+    auto to_vector = [](const auto & weights) {
+        return std::vector<float>(begin(weights), end(weights));
+    };
+    opencl_net.push_policy_head(head_weights.conv_pol_w,
+                                head_weights.conv_pol_b,
+                                to_vector(head_weights.bn_pol_w1),
+                                to_vector(head_weights.bn_pol_w2),
+                                to_vector(head_weights.ip_pol_w),
+                                to_vector(head_weights.ip_pol_b));
+    opencl_net.push_value_head(head_weights.conv_val_w,
+                               head_weights.conv_val_b,
+                               to_vector(head_weights.bn_val_w1),
+                               to_vector(head_weights.bn_val_w2),
+                               to_vector(head_weights.ip1_val_w),
+                               to_vector(head_weights.ip1_val_b),
+                               to_vector(head_weights.ip2_val_w),
+                               to_vector(head_weights.ip2_val_b));
     myprintf("done\n");
+
+    opencl_net.tune();
+#else
+    if (cfg_numa) {
+        replicate_weights();
+    }
+
+    // BLAS itself stays single threaded, one evaluation is split up
+    // over our own pool instead.
+    if (cfg_nn_threads > 1) {
+        myprintf("Splitting network evaluations over %d threads.\n",
+                 cfg_nn_threads);
+        // Helpers on the node of the searching thread, reading the
+        // same copy of the weights.
+        for (auto node = size_t{0}; node < node_tower_weights.size(); node++) {
+            node_nn_pools.emplace_back(std::make_unique<ThreadPool>());
+            node_nn_pools.back()->initialize(cfg_nn_threads - 1,
+                [node](size_t) { SMP::bind_thread_to_node(int(node)); });
+        }
+        if (node_nn_pools.empty()) {
+            nn_pool.initialize(cfg_nn_threads - 1);
+        }
+    }
 #endif
+
 #ifdef USE_BLAS
 #ifndef __APPLE__
 #ifdef USE_OPENBLAS
@@ -258,9 +388,30 @@ void Network::initialize(void) {
 }
 
 #ifdef USE_BLAS
-template<unsigned int filter_size,
-         unsigned int outputs>
-void convolve(const std::vector<float>& input,
+/*
+    Call f(begin, end) on slices of [0, count), one slice per thread
+    of the evaluation. The calling thread takes the first slice.
+*/
+template<typename F>
+static void parallel_for(size_t count, F f) {
+    auto slices = std::min(count, size_t(cfg_nn_threads));
+    if (slices <= 1) {
+        f(size_t{0}, count);
+        return;
+    }
+    auto slice_size = (count + slices - 1) / slices;
+    ThreadGroup tg(get_nn_pool());
+    for (auto begin = slice_size; begin < count; begin += slice_size) {
+        auto end = std::min(begin + slice_size, count);
+        tg.add_task([&f, begin, end]() { f(begin, end); });
+    }
+    f(size_t{0}, slice_size);
+    tg.wait_all();
+}
+
+template<unsigned int filter_size>
+void convolve(size_t outputs,
+              const std::vector<float>& input,
               const std::vector<float>& weights,
               const std::vector<float>& biases,
               std::vector<float>& output) {
@@ -270,6 +421,7 @@ void convolve(const std::vector<float>& input,
     constexpr unsigned int spatial_out = width * height;
     constexpr unsigned int filter_len = filter_size * filter_size;
 
+    assert(outputs == biases.size());
     auto channels = int(weights.size() / (biases.size() * filter_len));
     unsigned int filter_dim = filter_len * channels;
 
@@ -288,19 +440,22 @@ void convolve(const std::vector<float>& input,
     //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
     //                ldb, beta, C, N);
 
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, spatial_out, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], spatial_out,
-                0.0f, &output[0], spatial_out);
-
-    for (unsigned int o = 0; o < outputs; o++) {
-        for (unsigned int b = 0; b < spatial_out; b++) {
-            output[(o * spatial_out) + b] =
-                biases[o] + output[(o * spatial_out) + b];
+    // Every thread computes a band of output channels.
+    parallel_for(outputs, [&](size_t begin, size_t end) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    // M        N            K
+                    end - begin, spatial_out, filter_dim,
+                    1.0f, &weights[begin * filter_dim], filter_dim,
+                    &col[0], spatial_out,
+                    0.0f, &output[begin * spatial_out], spatial_out);
+
+        for (auto o = begin; o < end; o++) {
+            for (unsigned int b = 0; b < spatial_out; b++) {
+                output[(o * spatial_out) + b] =
+                    biases[o] + output[(o * spatial_out) + b];
+            }
         }
-    }
+    });
 }
 
 template<unsigned int inputs,
@@ -312,50 +467,130 @@ void innerproduct(const std::vector<float>& input,
                   std::vector<float>& output) {
     assert(B == outputs);
 
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
-
     auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
                                        val : 0.0f; };
 
-    for (unsigned int o = 0; o < outputs; o++) {
-        float val = biases[o] + output[o];
-        if (outputs == 256) {
-            val = lambda_ReLU(val);
+    parallel_for(outputs, [&](size_t begin, size_t end) {
+        cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                    // M     K
+                    end - begin, inputs,
+                    1.0f, &weights[begin * inputs], inputs,
+                    &input[0], 1,
+                    0.0f, &output[begin], 1);
+
+        for (auto o = begin; o < end; o++) {
+            float val = biases[o] + output[o];
+            if (outputs == 256) {
+                val = lambda_ReLU(val);
+            }
+            output[o] = val;
         }
-        output[o] = val;
-    }
+    });
 }
 
-template<unsigned int channels,
-         unsigned int spatial_size>
-void batchnorm(const std::vector<float>& input,
-               const std::array<float, channels>& means,
-               const std::array<float, channels>& variances,
-               std::vector<float>& output)
+/*
+    Batch normalization and ReLU. If eltwise is given, it is added
+    before the ReLU, which ends a residual block. input and output
+    may be the same.
+*/
+template<unsigned int spatial_size>
+void batchnorm(size_t channels,
+               const std::vector<float>& input,
+               const float* means,
+               const float* variances,
+               std::vector<float>& output,
+               const float* eltwise = nullptr)
 {
     constexpr float epsilon = 1e-5f;
 
     auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
                                        val : 0.0f; };
 
-    for (unsigned int c = 0; c < channels; ++c) {
-        float mean = means[c];
-        float variance = variances[c] + epsilon;
-        float scale_stddiv = 1.0f / std::sqrt(variance);
-
-        float * out = &output[c * spatial_size];
-        float const * in  = &input[c * spatial_size];
-        for (unsigned int b = 0; b < spatial_size; b++) {
-            out[b] = lambda_ReLU(scale_stddiv * (in[b] - mean));
+    parallel_for(channels, [&](size_t begin, size_t end) {
+        for (auto c = begin; c < end; ++c) {
+            float mean = means[c];
+            float variance = variances[c] + epsilon;
+            float scale_stddiv = 1.0f / std::sqrt(variance);
+
+            float * out = &output[c * spatial_size];
+            float const * in  = &input[c * spatial_size];
+            if (eltwise) {
+                float const * res = &eltwise[c * spatial_size];
+                for (unsigned int b = 0; b < spatial_size; b++) {
+                    out[b] = lambda_ReLU(scale_stddiv * (in[b] - mean)
+                                         + res[b]);
+                }
+            } else {
+                for (unsigned int b = 0; b < spatial_size; b++) {
+                    out[b] = lambda_ReLU(scale_stddiv * (in[b] - mean));
+                }
+            }
         }
+    });
+}
+
+#ifndef USE_OPENCL
+/*
+    The whole network, mirroring what OpenCL_Network::forward does on
+    the GPU. output gets Network::NET_OUTPUTS floats.
+*/
+static void forward_cpu(const std::vector<float>& input,
+                        std::vector<float>& output) {
+    constexpr unsigned int spatial_size = 19 * 19;
+    const auto & t = get_tower_weights();
+    const auto & conv_weights = t.conv_weights;
+    const auto & conv_biases = t.conv_biases;
+    const auto & batchnorm_means = t.batchnorm_means;
+    const auto & batchnorm_variances = t.batchnorm_variances;
+    auto channels = conv_biases[0].size();
+    std::vector<float> tower(channels * spatial_size);
+    std::vector<float> conv_out(channels * spatial_size);
+    std::vector<float> residual(channels * spatial_size);
+
+    convolve<3>(channels, input, conv_weights[0], conv_biases[0], tower);
+    batchnorm<spatial_size>(channels, tower,
+                            batchnorm_means[0].data(),
+                            batchnorm_variances[0].data(),
+                            tower);
+
+    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
+        std::copy(begin(tower), end(tower), begin(residual));
+        convolve<3>(channels, tower,
+                    conv_weights[i], conv_biases[i], conv_out);
+        batchnorm<spatial_size>(channels, conv_out,
+                                batchnorm_means[i].data(),
+                                batchnorm_variances[i].data(),
+                                conv_out);
+        convolve<3>(channels, conv_out,
+                    conv_weights[i + 1], conv_biases[i + 1], tower);
+        batchnorm<spatial_size>(channels, tower,
+                                batchnorm_means[i + 1].data(),
+                                batchnorm_variances[i + 1].data(),
+                                tower, residual.data());
     }
+
+    const auto & w = get_head_weights();
+    std::vector<float> policy_data(2 * spatial_size);
+    std::vector<float> value_data(1 * spatial_size);
+    std::vector<float> winrate_data(256);
+    std::vector<float> winrate_out(1);
+
+    // Get the moves
+    convolve<1>(2, tower, w.conv_pol_w, w.conv_pol_b, policy_data);
+    batchnorm<spatial_size>(2, policy_data, w.bn_pol_w1.data(),
+                            w.bn_pol_w2.data(), policy_data);
+    innerproduct<2*361, 362>(policy_data, w.ip_pol_w, w.ip_pol_b, output);
+
+    // Now get the score
+    convolve<1>(1, tower, w.conv_val_w, w.conv_val_b, value_data);
+    batchnorm<spatial_size>(1, value_data, w.bn_val_w1.data(),
+                            w.bn_val_w2.data(), value_data);
+    innerproduct<361, 256>(value_data, w.ip1_val_w, w.ip1_val_b, winrate_data);
+    innerproduct<256, 1>(winrate_data, w.ip2_val_w, w.ip2_val_b, winrate_out);
+    output[Network::NET_OUTPUTS - 1] = winrate_out[0];
 }
 #endif
+#endif
 
 void Network::softmax(const std::vector<float>& input,
                       std::vector<float>& output,
@@ -401,67 +636,317 @@ Network::Netresult Network::get_scored_moves(
     return result;
 }
 
-Network::Netresult Network::get_scored_moves_internal(
-    GameState * state, NNPlanes & planes, int rotation) {
+std::vector<Network::Netresult> Network::get_scored_moves(
+    const std::vector<GameState*> & states, Ensemble ensemble, int rotation) {
+    std::vector<Netresult> results;
+#ifdef USE_OPENCL
+    std::vector<uint32> packed_data(PACKED_INPUT_WORDS);
+    std::vector<float> output_data(NET_OUTPUTS);
+    std::vector<int> rotations(states.size());
+
+    auto queue_position = [&](size_t i) {
+        NNPlanes planes;
+        gather_features(states[i], planes);
+        if (ensemble == DIRECT) {
+            assert(rotation >= 0 && rotation <= 7);
+            rotations[i] = rotation;
+        } else {
+            assert(ensemble == RANDOM_ROTATION);
+            assert(rotation == -1);
+            rotations[i] = Random::get_Rng()->randfix<8>();
+        }
+        pack_input(planes, rotations[i], packed_data);
+        return opencl_net.forward_async(packed_data);
+    };
+
+    // Keep the device busy with the next position while the output
+    // of this one is processed here.
+    auto slot = -1;
+    for (size_t i = 0; i < states.size(); i++) {
+        if (states[i]->board.get_boardsize() != 19) {
+            results.emplace_back();
+            continue;
+        }
+        if (slot < 0) {
+            slot = queue_position(i);
+        }
+        auto next = i + 1;
+        while (next < states.size()
+               && states[next]->board.get_boardsize() != 19) {
+            next++;
+        }
+        auto next_slot = -1;
+        if (next < states.size()) {
+            next_slot = queue_position(next);
+        }
+        opencl_net.forward_wait(slot, output_data);
+        results.emplace_back(evaluate_output(states[i], output_data,
+                                            rotations[i]));
+        slot = next_slot;
+    }
+#else
+    for (auto state : states) {
+        results.emplace_back(get_scored_moves(state, ensemble, rotation));
+    }
+#endif
+    return results;
+}
+
+void Network::fill_input(const NNPlanes & planes, int rotation,
+                         std::vector<float> & input_data) {
     assert(rotation >= 0 && rotation <= 7);
     constexpr int channels = INPUT_CHANNELS;
     assert(channels == planes.size());
-    constexpr int width = 19;
-    constexpr int height = 19;
-    constexpr int max_channels = MAX_CHANNELS;
-    std::vector<float> input_data(max_channels * width * height);
-    std::vector<float> output_data(max_channels * width * height);
-    std::vector<float> policy_data_1(2 * width * height);
-    std::vector<float> policy_data_2(2 * width * height);
-    std::vector<float> value_data_1(1 * width * height);
-    std::vector<float> value_data_2(1 * width * height);
-    std::vector<float> policy_out((width * height) + 1);
-    std::vector<float> softmax_data((width * height) + 1);
-    std::vector<float> winrate_data(256);
-    std::vector<float> winrate_out(1);
+    constexpr int spatial_size = 19 * 19;
+    const auto & rotate = rotation_table[rotation];
     for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < height; ++h) {
-            for (int w = 0; w < width; ++w) {
-                auto rot_idx = rotate_nn_idx(h * 19 + w, rotation);
-                input_data[(c * height + h) * width + w] =
-                    (float)planes[c][rot_idx];
+        auto plane = begin(input_data) + c * spatial_size;
+        for (int idx = 0; idx < spatial_size; ++idx) {
+            plane[idx] = (float)planes[c][rotate[idx]];
+        }
+    }
+}
+
+/*
+    The device unpacks the bits into float planes and applies the
+    symmetry, so only PACKED_INPUT_WORDS words are uploaded.
+*/
+void Network::pack_input(const NNPlanes & planes, int rotation,
+                         std::vector<uint32> & packed_data) {
+    assert(rotation >= 0 && rotation <= 7);
+    assert(planes.size() == INPUT_CHANNELS);
+    std::fill(begin(packed_data), end(packed_data), 0);
+    for (int c = 0; c < HISTORY_PLANES; ++c) {
+        auto plane = begin(packed_data) + c * PLANE_WORDS;
+        for (int idx = 0; idx < 19 * 19; ++idx) {
+            if (planes[c][idx]) {
+                plane[idx / 32] |= 1u << (idx % 32);
             }
         }
     }
+    // planes[16] is black to move, planes[17] white to move
+    packed_data[HISTORY_PLANES * PLANE_WORDS] = planes[17].any();
+    packed_data[HISTORY_PLANES * PLANE_WORDS + 1] = rotation;
+}
+
 #ifdef USE_OPENCL
-    opencl_net.forward(input_data, output_data);
-    // Get the moves
-    convolve<1, 2>(output_data, conv_pol_w, conv_pol_b, policy_data_1);
-    batchnorm<2, 361>(policy_data_1, bn_pol_w1, bn_pol_w2, policy_data_2);
-    innerproduct<2*361, 362>(policy_data_2, ip_pol_w, ip_pol_b, policy_out);
-    softmax(policy_out, softmax_data, cfg_softmax_temp);
-    std::vector<float>& outputs = softmax_data;
+// An evaluation waiting for the batching thread
+struct BatchRequest {
+    const std::vector<uint32> * input;
+    std::vector<float> * output;
+    bool done{false};
+    std::exception_ptr error;
+};
+
+// How long the batching thread waits for a batch to fill up
+static constexpr auto BATCH_WAIT = std::chrono::milliseconds(1);
+
+// State of the batching thread, guarded by batch_mutex
+static std::mutex batch_mutex;
+static std::condition_variable batch_queued;
+static std::condition_variable batch_done;
+static std::vector<BatchRequest*> batch_queue;
+// Requests taken off batch_queue and not finished yet
+static size_t batch_in_flight{0};
+static size_t batch_max{0};
+static bool batch_exit{false};
+static std::thread batch_thread;
+
+// Wake the searches whose positions are in batch
+static void finish_batch(const std::vector<BatchRequest*> & batch,
+                         std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        for (auto request : batch) {
+            request->error = error;
+            request->done = true;
+        }
+        batch_in_flight -= batch.size();
+    }
+    batch_done.notify_all();
+}
 
-    // Now get the score
-    convolve<1, 1>(output_data, conv_val_w, conv_val_b, value_data_1);
-    batchnorm<1, 361>(value_data_1, bn_val_w1, bn_val_w2, value_data_2);
-    innerproduct<361, 256>(value_data_2, ip1_val_w, ip1_val_b, winrate_data);
-    innerproduct<256, 1>(winrate_data, ip2_val_w, ip2_val_b, winrate_out);
+// Ends the fill wait of batch_loop when a pass is done
+static void wake_batch_loop() {
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+    }
+    batch_queued.notify_one();
+}
 
-    // Sigmoid
-    float winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
-#elif defined(USE_BLAS) && !defined(USE_OPENCL)
-#error "Not implemented"
-    // Not implemented yet - not very useful unless you have some
-    // sort of Xeon Phi
+/*
+    Keeps up to PIPELINE_DEPTH batches on the device, so the next batch
+    is collected and uploaded while the current one runs, and the
+    searches get their results back while the device works on the next.
+*/
+static void batch_loop() {
+    constexpr size_t depth = ThreadData::PIPELINE_DEPTH;
+    // Batches on the device and their forward_async slots, oldest first
+    std::deque<std::pair<std::vector<BatchRequest*>, int>> in_flight;
+    std::vector<uint32> packed_data;
+    std::vector<float> output_data;
+    for (;;) {
+        std::vector<BatchRequest*> batch;
+        {
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            if (in_flight.empty()) {
+                batch_queued.wait(lock, [] {
+                    return batch_exit || !batch_queue.empty();
+                });
+                if (batch_queue.empty()) {
+                    return;
+                }
+            }
+            if (in_flight.size() < depth) {
+                // The other searches are usually a tree descent away
+                // from queueing theirs, give them a moment. Searches
+                // waiting on a batch in flight can't queue anything,
+                // and once the oldest batch is done its searches are
+                // better served by collecting it.
+                batch_queued.wait_for(lock, BATCH_WAIT, [&in_flight] {
+                    return batch_exit
+                        || batch_queue.size() + batch_in_flight >= batch_max
+                        || (!in_flight.empty()
+                            && opencl_net.forward_ready(
+                                   in_flight.front().second));
+                });
+                auto count = std::min(batch_queue.size(), batch_max);
+                batch.assign(begin(batch_queue), begin(batch_queue) + count);
+                batch_queue.erase(begin(batch_queue),
+                                  begin(batch_queue) + count);
+                batch_in_flight += count;
+            }
+        }
+
+        auto queued = !batch.empty();
+        if (queued) {
+            try {
+                packed_data.resize(batch.size() * Network::PACKED_INPUT_WORDS);
+                for (size_t i = 0; i < batch.size(); i++) {
+                    std::copy(begin(*batch[i]->input), end(*batch[i]->input),
+                              begin(packed_data)
+                              + i * Network::PACKED_INPUT_WORDS);
+                }
+                auto slot = opencl_net.forward_async(packed_data,
+                                                     batch.size(),
+                                                     wake_batch_loop);
+                in_flight.emplace_back(std::move(batch), slot);
+            } catch (...) {
+                finish_batch(batch, std::current_exception());
+            }
+        }
+
+        // Collect the oldest batch when no more can be queued, when
+        // there was nothing to queue behind it, or when it is done.
+        if (in_flight.empty()
+            || (in_flight.size() < depth && queued
+                && !opencl_net.forward_ready(in_flight.front().second))) {
+            continue;
+        }
+        auto & oldest = in_flight.front();
+        std::exception_ptr error;
+        try {
+            output_data.resize(oldest.first.size() * Network::NET_OUTPUTS);
+            opencl_net.forward_wait(oldest.second, output_data);
+            for (size_t i = 0; i < oldest.first.size(); i++) {
+                auto output = begin(output_data) + i * Network::NET_OUTPUTS;
+                std::copy(output, output + Network::NET_OUTPUTS,
+                          begin(*oldest.first[i]->output));
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        finish_batch(oldest.first, error);
+        in_flight.pop_front();
+    }
+}
+
+// Hand the position to the batching thread and wait for its output
+static void forward_batched(const std::vector<uint32> & input,
+                            std::vector<float> & output) {
+    BatchRequest request;
+    request.input = &input;
+    request.output = &output;
+    std::unique_lock<std::mutex> lock(batch_mutex);
+    batch_queue.emplace_back(&request);
+    batch_queued.notify_one();
+    batch_done.wait(lock, [&] { return request.done; });
+    if (request.error) {
+        std::rethrow_exception(request.error);
+    }
+}
+#endif
+
+void Network::start_batching(size_t max_batch) {
+#ifdef USE_OPENCL
+    assert(max_batch > 0);
+    assert(!batch_thread.joinable());
+    if (max_batch < 2) {
+        // The search calls the device directly, see
+        // get_scored_moves_internal
+        return;
+    }
+    batch_max = max_batch;
+    batch_exit = false;
+    batch_thread = std::thread(batch_loop);
+#else
+    (void)max_batch;
+#endif
+}
+
+void Network::stop_batching() {
+#ifdef USE_OPENCL
+    if (!batch_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        batch_exit = true;
+    }
+    batch_queued.notify_one();
+    batch_thread.join();
+    batch_max = 0;
+#endif
+}
+
+Network::Netresult Network::get_scored_moves_internal(
+    GameState * state, NNPlanes & planes, int rotation) {
+    std::vector<float> output_data(NET_OUTPUTS);
+#ifdef USE_OPENCL
+    std::vector<uint32> packed_data(PACKED_INPUT_WORDS);
+    pack_input(planes, rotation, packed_data);
+    if (batch_max > 0) {
+        forward_batched(packed_data, output_data);
+    } else {
+        opencl_net.forward(packed_data, output_data);
+    }
+#else
+    std::vector<float> input_data(INPUT_CHANNELS * 19 * 19);
+    fill_input(planes, rotation, input_data);
+    forward_cpu(input_data, output_data);
+#endif
+    return evaluate_output(state, output_data, rotation);
+}
+
+Network::Netresult Network::evaluate_output(
+    GameState * state, const std::vector<float> & output_data, int rotation) {
+    std::vector<float> softmax_data(NET_OUTPUTS - 1);
     softmax(output_data, softmax_data, cfg_softmax_temp);
-    // Move scores
     std::vector<float>& outputs = softmax_data;
-#endif
+
+    // Sigmoid
+    float winrate_sig = (1.0f + std::tanh(output_data[NET_OUTPUTS - 1])) / 2.0f;
+
+    auto legal = state->generate_moves(state->board.get_to_move());
     std::vector<scored_node> result;
     for (size_t idx = 0; idx < outputs.size(); idx++) {
         if (idx < 19*19) {
             auto val = outputs[idx];
-            auto rot_idx = rotate_nn_idx(idx, rotation);
+            auto rot_idx = rotation_table[rotation][idx];
             int x = rot_idx % 19;
             int y = rot_idx / 19;
             int rot_vtx = state->board.get_vertex(x, y);
-            if (state->board.get_square(rot_vtx) == FastBoard::EMPTY) {
+            if (legal[rot_vtx]) {
                 result.emplace_back(val, rot_vtx);
             }
         } else {
@@ -571,36 +1056,3 @@ void Network::gather_features(GameState * state, NNPlanes & planes) {
         state->forward_move();
     }
 }
-
-int Network::rotate_nn_idx(const int vertex, int symmetry) {
-    assert(vertex >= 0 && vertex < 19*19);
-    assert(symmetry >= 0 && symmetry < 8);
-    int x = vertex % 19;
-    int y = vertex / 19;
-    int newx;
-    int newy;
-
-    if (symmetry >= 4) {
-        std::swap(x, y);
-        symmetry -= 4;
-    }
-
-    if (symmetry == 0) {
-        newx = x;
-        newy = y;
-    } else if (symmetry == 1) {
-        newx = x;
-        newy = 19 - y - 1;
-    } else if (symmetry == 2) {
-        newx = 19 - x - 1;
-        newy = y;
-    } else {
-        assert(symmetry == 3);
-        newx = 19 - x - 1;
-        newy = 19 - y - 1;
-    }
-
-    int newvtx = (newy * 19) + newx;
-    assert(newvtx >= 0 && newvtx < 19*19);
-    return newvtx;
-}
@@ -20,6 +20,8 @@
 #define NETWORK_H_INCLUDED
 
 #include "config.h"
+#include <cassert>
+#include <utility>
 #include <vector>
 #include <string>
 #include <bitset>
@@ -47,23 +49,97 @@ public:
     static Netresult get_scored_moves(GameState * state,
                                       Ensemble ensemble,
                                       int rotation = -1);
+    /*
+        Evaluate several positions. With OpenCL the next position is
+        already on the device while the output of the current one is
+        processed.
+    */
+    static std::vector<Netresult> get_scored_moves(
+        const std::vector<GameState*> & states,
+        Ensemble ensemble,
+        int rotation = -1);
     // File format version
     static constexpr int FORMAT_VERSION = 1;
     static constexpr int INPUT_CHANNELS = 18;
     static constexpr int MAX_CHANNELS = 256;
+    // Per position: the move logits, pass last, then the value head
+    // output before tanh
+    static constexpr int NET_OUTPUTS = 19 * 19 + 2;
+    // Packed input: the 16 history planes as bits, then whether white
+    // is to move and the symmetry to apply when unpacking.
+    static constexpr int HISTORY_PLANES = 16;
+    static constexpr int PLANE_WORDS = (19 * 19 + 31) / 32;
+    static constexpr int PACKED_INPUT_WORDS =
+        HISTORY_PLANES * PLANE_WORDS + 2;
 
     static void initialize();
+    /*
+        Have a thread of its own collect the evaluations of concurrent
+        searches and run up to max_batch of them through the device at
+        once, with the next batch queued while one runs. main starts it
+        for all search threads, see --selfplay for many of those.
+        A single search gains nothing from it, so with max_batch 1, or
+        without OpenCL, every search keeps evaluating on its own thread
+        and these do nothing.
+    */
+    static void start_batching(size_t max_batch);
+    static void stop_batching();
     static void benchmark(GameState * state);
     static void show_heatmap(FastState * state, Netresult & netres, bool topmoves);
     static void softmax(const std::vector<float>& input,
                         std::vector<float>& output,
                         float temperature = 1.0f);
     static void gather_features(GameState* state, NNPlanes & planes);
+    static int rotate_nn_idx(const int vertex, int symmetry);
 
 private:
     static Netresult get_scored_moves_internal(
       GameState * state, NNPlanes & planes, int rotation);
-    static int rotate_nn_idx(const int vertex, int symmetry);
+    static void fill_input(const NNPlanes & planes, int rotation,
+                           std::vector<float> & input_data);
+    static void pack_input(const NNPlanes & planes, int rotation,
+                           std::vector<uint32> & packed_data);
+    static Netresult evaluate_output(GameState * state,
+                                     const std::vector<float> & output_data,
+                                     int rotation);
 };
 
+/*
+    Map a point (y * 19 + x) to the point it comes from under one of the
+    8 board symmetries. The training data loader in training/loader
+    uses it too, so the network sees the same transforms both ways.
+*/
+inline int Network::rotate_nn_idx(const int vertex, int symmetry) {
+    assert(vertex >= 0 && vertex < 19*19);
+    assert(symmetry >= 0 && symmetry < 8);
+    int x = vertex % 19;
+    int y = vertex / 19;
+    int newx;
+    int newy;
+
+    if (symmetry >= 4) {
+        std::swap(x, y);
+        symmetry -= 4;
+    }
+
+    if (symmetry == 0) {
+        newx = x;
+        newy = y;
+    } else if (symmetry == 1) {
+        newx = x;
+        newy = 19 - y - 1;
+    } else if (symmetry == 2) {
+        newx = 19 - x - 1;
+        newy = y;
+    } else {
+        assert(symmetry == 3);
+        newx = 19 - x - 1;
+        newy = 19 - y - 1;
+    }
+
+    int newvtx = (newy * 19) + newx;
+    assert(newvtx >= 0 && newvtx < 19*19);
+    return newvtx;
+}
+
 #endif
@@ -19,6 +19,9 @@
 #include "config.h"
 #ifdef USE_OPENCL
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -27,8 +30,15 @@
 #include <sstream>
 #include <fstream>
 #include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <random>
 #include <array>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 
@@ -48,11 +58,15 @@ static std::string sourceCode_convolve1 = R"(
                    __global float * merge,
                    __global const float * weights,
                    __local float * channel_buff,
-                   __local float * row_buff) {
-        // cl::NDRange global(channels, outputs, row);
+                   __local float * row_buff,
+                   const int row_buff_size,
+                   const int chan_buff_size,
+                   const int chan_shift) {
+        // cl::NDRange global(channels, outputs, batch * row);
         const int c   = get_global_id(0);  // channel
         const int o   = get_global_id(1);  // output
-        const int row = get_global_id(2);  // row
+        const int row = get_global_id(2) % 19;  // row
+        const int batch = get_global_id(2) / 19;
 
         const int channels = get_global_size(0);
         const int outputs  = get_global_size(1);
@@ -61,20 +75,20 @@ static std::string sourceCode_convolve1 = R"(
         const int lx = get_local_id(0);
         const int ly = get_local_id(1);
 
-        const int chan_buff_size = 8;
         const int out_buff_size  = get_local_size(1);
-        const int row_buff_size  = 7;
-        const int chan_shift     = 3;
 
-        // input = channels * height * width
-        // output = outputs * height * width
+        // input = batch * channels * height * width
+        // output = batch * outputs * height * width
         // weights = output * channels * filter
-        // merge = channels * outputs * height * width
+        // merge = batch * channels * outputs * height * width
 
         const int width = 19;
         const int height = 19;
         const int strip_size = width;
 
+        in += batch * channels * height * width;
+        merge += batch * (channels >> chan_shift) * outputs * height * width;
+
         // Copy the input channels (strips) locally
         if (out_buff_size < 19 && ly == 0) {
             // strip-row
@@ -105,14 +119,19 @@ static std::string sourceCode_convolve1 = R"(
                 barrier(CLK_LOCAL_MEM_FENCE);
                 if (lx < out_lane) {
                     float val;
-                    val  = row_buff[(ly * chan_buff_size + 0) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 1) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 2) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 3) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 4) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 5) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 6) * row_buff_size + lx];
-                    val += row_buff[(ly * chan_buff_size + 7) * row_buff_size + lx];
+                    if (chan_buff_size == 8) {
+                        val  = row_buff[(ly * chan_buff_size + 0) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 1) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 2) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 3) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 4) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 5) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 6) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 7) * row_buff_size + lx];
+                    } else {
+                        val  = row_buff[(ly * chan_buff_size + 0) * row_buff_size + lx];
+                        val += row_buff[(ly * chan_buff_size + 1) * row_buff_size + lx];
+                    }
                     merge[(((c >> chan_shift) * height + row) * width + out_cw + lx) * outputs + o] = val;
                 }
                 out_cw  += row_buff_size;
@@ -136,10 +155,12 @@ static std::string sourceCode_convolve3 = R"(
                    const int chan_buff_size,
                    const int chan_shift) {
 
-        // cl::NDRange global(channels, outputs, row);
+        // cl::NDRange global(channels, outputs, batch * row_tiles);
+        const int row_tiles = (19 + row_tile_size - 1) / row_tile_size;
         const int c   = get_global_id(0);  // channel
         const int o   = get_global_id(1);  // output
-        const int r   = get_global_id(2);  // row
+        const int r   = get_global_id(2) % row_tiles;  // row tile
+        const int batch = get_global_id(2) / row_tiles;
 
         const int channels = get_global_size(0);
         const int outputs  = get_global_size(1);
@@ -158,10 +179,13 @@ static std::string sourceCode_convolve3 = R"(
         const int extent = mid - 1;
         const int pad_width = width + filter_size - 1;
 
-        // input = channels * height * width
-        // output = outputs * height * width
+        // input = batch * channels * height * width
+        // output = batch * outputs * height * width
         // weights = output * channels * filter
-        // merge = channels * outputs * height * width
+        // merge = batch * channels * outputs * height * width
+
+        in += batch * channels * height * width;
+        merge += batch * (channels >> chan_shift) * outputs * height * width;
 
         __private float filter_buff[9];
         __private float chan_cache[2];
@@ -291,27 +315,74 @@ static std::string sourceCode_convolve3 = R"(
 )";
 
 static std::string sourceCode_utility = R"(
+    __kernel void unpack_input(
+                        __global const uint * packed,
+                        __global float * out) {
+        // cl::NDRange global(19 * 19, channels, batch);
+        const int vertex = get_global_id(0);
+        const int c      = get_global_id(1);
+        const int batch  = get_global_id(2);
+
+        const int channels = get_global_size(1);
+
+        // Network::PACKED_INPUT_WORDS
+        const int history_planes = 16;
+        const int plane_words    = 12;
+
+        packed += batch * (history_planes * plane_words + 2);
+        const uint white_to_move = packed[history_planes * plane_words];
+        const int symmetry       = packed[history_planes * plane_words + 1];
+
+        float val;
+        if (c < history_planes) {
+            // Network::rotate_nn_idx
+            int x = vertex % 19;
+            int y = vertex / 19;
+            if (symmetry >= 4) {
+                int tmp = x;
+                x = y;
+                y = tmp;
+            }
+            if (symmetry & 1) {
+                y = 19 - y - 1;
+            }
+            if (symmetry & 2) {
+                x = 19 - x - 1;
+            }
+            const int idx = y * 19 + x;
+            val = (packed[c * plane_words + idx / 32] >> (idx % 32)) & 1;
+        } else {
+            // Black to move, then white to move
+            val = (c == history_planes) != white_to_move;
+        }
+        out[(batch * channels + c) * 19 * 19 + vertex] = val;
+    }
+
     __kernel void merge(
                         __global const float * in,
                         __global float * out,
                         __constant const float * biases,
                         __private const int channels) {
 
-        // cl::NDRange global(outputs, 19*19);
+        // cl::NDRange global(outputs, batch * 19*19);
         const int gx = get_global_id(0);
         const int gy = get_global_id(1);
 
-        const int output = gx;
-        const int b = gy;
-        const int outputs = get_global_size(0);
-
         const int width = 19;
         const int height = 19;
         const int boardsize = width * height;
 
+        const int output = gx;
+        const int b = gy % boardsize;
+        const int batch = gy / boardsize;
+        const int outputs = get_global_size(0);
+
         const int o = output;
         const float bias = biases[o];
 
+        in += batch * channels * boardsize * outputs;
+        out += batch * outputs * boardsize;
+
         float sum = bias;
         for (int c = 0; c < channels; c++) {
             sum += in[(c * boardsize + b) * outputs + o];
@@ -324,18 +395,25 @@ static std::string sourceCode_utility = R"(
                         __global float * out,
                         __global const float * residual,
                         __constant const float * means,
-                        __constant const float * variances) {
+                        __constant const float * variances,
+                        __private const int channel_size) {
 
-        // cl::NDRange global(outputs, 19*19);
+        // cl::NDRange global(outputs, batch * channel_size);
         const int gx = get_global_id(0);
         const int gy = get_global_id(1);
 
         const int output = gx;
         const int outputs      = get_global_size(0);
-        const int channel_size = get_global_size(1);
 
         const unsigned int o = output;
-        const unsigned int b = gy;
+        const unsigned int b = gy % channel_size;
+        const unsigned int batch = gy / channel_size;
+
+        in += batch * outputs * channel_size;
+        out += batch * outputs * channel_size;
+        if (residual) {
+            residual += batch * outputs * channel_size;
+        }
 
         const float epsilon = 1e-5;
 
@@ -352,6 +430,33 @@ static std::string sourceCode_utility = R"(
         // ReLU
         out[o * channel_size + b] = sum > 0 ? sum : 0.0f;
     }
+
+    __kernel void innerproduct(
+                        __global const float * in,
+                        __global float * out,
+                        __global const float * weights,
+                        __constant const float * biases,
+                        __private const int inputs,
+                        __private const int relu,
+                        __private const int out_offset,
+                        __private const int out_stride) {
+
+        // cl::NDRange global(outputs, batch);
+        const int o = get_global_id(0);
+        const int batch = get_global_id(1);
+
+        in += batch * inputs;
+        weights += o * inputs;
+
+        float sum = biases[o];
+        for (int i = 0; i < inputs; i++) {
+            sum += weights[i] * in[i];
+        }
+        if (relu) {
+            sum = sum > 0 ? sum : 0.0f;
+        }
+        out[batch * out_stride + out_offset + o] = sum;
+    }
 )";
 
 OpenCL opencl;
@@ -365,6 +470,8 @@ void OpenCL::ensure_thread_initialized() {
         opencl_thread_data.m_convolve3_kernel = cl::Kernel(m_program, "convolve3");
         opencl_thread_data.m_merge_kernel = cl::Kernel(m_program, "merge");
         opencl_thread_data.m_batchnorm_kernel = cl::Kernel(m_program, "batchnorm");
+        opencl_thread_data.m_innerproduct_kernel = cl::Kernel(m_program, "innerproduct");
+        opencl_thread_data.m_unpack_kernel = cl::Kernel(m_program, "unpack_input");
         opencl_thread_data.m_commandqueue = cl::CommandQueue(cl::Context::getDefault(),
                                                              cl::Device::getDefault());
         opencl_thread_data.m_is_initialized = true;
@@ -378,33 +485,102 @@ void OpenCL_Network::add_weights(size_t layer,
         m_layers.push_back(Layer());
     }
 
+    add_weights(m_layers.back(), size, weights);
+}
+
+void OpenCL_Network::add_weights(Layer & layer,
+                                 size_t size,
+                                 const float * weights) {
     size_t weightSize = size *
         sizeof(std::remove_pointer<decltype(weights)>::type);
 
     cl::Buffer bufferWeights = cl::Buffer(CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
                                           weightSize, const_cast<float*>(weights));
 
-    m_layers.back().weights.push_back(bufferWeights);
+    layer.weights.push_back(bufferWeights);
+}
+
+/*
+    Size of the scratch buffer the convolutions merge into, per position.
+    Every input channel group writes its own partial sums.
+*/
+size_t OpenCL_Network::get_merge_size() const {
+    constexpr size_t one_plane = 19 * 19 * sizeof(float);
+    auto merge_size = size_t{0};
+    for (auto& layer : m_layers) {
+        if (!layer.is_batchnorm) {
+            auto groups = layer.channels
+                / get_channel_group(layer.filter_size, layer.channels);
+            merge_size = std::max(merge_size,
+                                  groups * layer.outputs * one_plane);
+        }
+    }
+    // The heads are 1x1 convolutions of the tower output
+    auto channels = m_layers.back().outputs;
+    auto groups = channels / get_channel_group(1, channels);
+    auto head_outputs = std::max(m_policy_head.outputs, m_value_head.outputs);
+    merge_size = std::max(merge_size, groups * head_outputs * one_plane);
+    return merge_size;
+}
+
+int OpenCL_Network::get_channel_group(int filter_size, int channels) const {
+    // Input layer is not a multiple of 8
+    if (channels % 8 != 0) {
+        return 2;
+    }
+    if (filter_size == 3) {
+        return m_tuning.channel_group;
+    }
+    return m_tuning.conv1_channel_group;
+}
+
+void OpenCL_Network::forward(const std::vector<uint32>& input,
+                             std::vector<float>& output,
+                             size_t batch_size) {
+    auto slot = forward_async(input, batch_size);
+    forward_wait(slot, output);
+}
+
+// Called by the OpenCL runtime once a pass has been read back
+void CL_CALLBACK OpenCL_Network::forward_done(cl_event, cl_int,
+                                              void * data) {
+    auto pass = static_cast<InFlight*>(data);
+    std::function<void()> on_done;
+    {
+        std::lock_guard<std::mutex> lock(pass->m_mutex);
+        pass->m_done = true;
+        on_done = pass->m_on_done;
+        pass->m_condvar.notify_all();
+    }
+    if (on_done) {
+        on_done();
+    }
 }
 
-void OpenCL_Network::forward(const std::vector<float>& input,
-                             std::vector<float>& output) {
+int OpenCL_Network::forward_async(const std::vector<uint32>& input,
+                                  size_t batch_size,
+                                  std::function<void()> on_done) {
     constexpr int width = 19;
     constexpr int height = 19;
     constexpr size_t one_plane = width * height * sizeof(float);
 
     opencl.ensure_thread_initialized();
-    const size_t midSize = one_plane * Network::MAX_CHANNELS;
-    const size_t inSize = sizeof(float) * input.size();
-    const size_t finalSize = m_layers.back().outputs * one_plane;
+    const size_t inSize = Network::PACKED_INPUT_WORDS * sizeof(uint32)
+                          * batch_size;
+    const size_t finalSize = Network::NET_OUTPUTS * sizeof(float) * batch_size;
 
-    if (!opencl_thread_data.m_buffers_allocated) {
-        size_t alloc_midSize = one_plane * Network::MAX_CHANNELS;
-        size_t alloc_mergeSize = one_plane *
-            Network::MAX_CHANNELS * (Network::MAX_CHANNELS / 2);
+    assert(input.size() * sizeof(uint32) >= inSize);
+
+    auto slot = opencl_thread_data.m_next_pass;
+    opencl_thread_data.m_next_pass = (slot + 1) % ThreadData::PIPELINE_DEPTH;
+    auto & pass = opencl_thread_data.m_passes[slot];
+    // The caller has to collect a pass before its slot comes round again
+    assert(!pass.m_busy);
+
+    const size_t alloc_midSize = one_plane * Network::MAX_CHANNELS * batch_size;
+    if (opencl_thread_data.m_batch_size < batch_size) {
+        size_t alloc_mergeSize = get_merge_size() * batch_size;
 
-        opencl_thread_data.m_inBuffer = cl::Buffer(
-            CL_MEM_READ_WRITE, alloc_midSize);
         opencl_thread_data.m_tmpBuffer = cl::Buffer(
             CL_MEM_READ_WRITE, alloc_midSize);
         opencl_thread_data.m_residualBuffer = cl::Buffer(
@@ -413,23 +589,35 @@ void OpenCL_Network::forward(const std::vector<float>& input,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_mergeSize);
         opencl_thread_data.m_outBuffer = cl::Buffer(
             CL_MEM_WRITE_ONLY, finalSize);
-        opencl_thread_data.m_buffers_allocated = true;
+        opencl_thread_data.m_batch_size = batch_size;
+    }
+    if (pass.m_batch_size < batch_size) {
+        pass.m_packedBuffer = cl::Buffer(CL_MEM_READ_ONLY, inSize);
+        pass.m_inBuffer = cl::Buffer(CL_MEM_READ_WRITE, alloc_midSize);
+        pass.m_batch_size = batch_size;
     }
 
-    cl::Buffer & inBuffer = opencl_thread_data.m_inBuffer;
-    cl::Buffer & outBuffer = opencl_thread_data.m_outBuffer;
-    cl::Buffer & tmpBuffer = opencl_thread_data.m_tmpBuffer;
+    // Device buffers are handles, the local copies get swapped around
+    // between layers.
+    cl::Buffer inBuffer = pass.m_inBuffer;
+    cl::Buffer tmpBuffer = opencl_thread_data.m_tmpBuffer;
     cl::Buffer & mergeBuffer = opencl_thread_data.m_mergeBuffer;
     cl::Buffer & residualBuffer = opencl_thread_data.m_residualBuffer;
+    cl::Buffer & outBuffer = opencl_thread_data.m_outBuffer;
     cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
 
-    // XXX: this copies a lot of zeroes
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, input.data());
+    // The write happens later, so it gets its own copy of the input.
+    pass.m_input.assign(begin(input), begin(input) + inSize / sizeof(uint32));
+    pass.m_output.resize(finalSize / sizeof(float));
+    queue.enqueueWriteBuffer(pass.m_packedBuffer, CL_FALSE, 0, inSize,
+                             pass.m_input.data());
+    unpack_input(batch_size, pass.m_packedBuffer, inBuffer);
 
     for (auto& layer : m_layers) {
         if (layer.is_batchnorm) {
             batchnorm(layer.outputs,
                       layer.filter_size,
+                      batch_size,
                       inBuffer,
                       tmpBuffer,
                       nullptr,
@@ -444,10 +632,12 @@ void OpenCL_Network::forward(const std::vector<float>& input,
                                                          begin(layer.weights) + 6);
             auto bn2_weights   = std::vector<cl::Buffer>(begin(layer.weights) + 6,
                                                          begin(layer.weights) + 8);
-            queue.enqueueCopyBuffer(inBuffer, residualBuffer, 0, 0, midSize);
+            const size_t residualSize = layer.channels * one_plane * batch_size;
+            queue.enqueueCopyBuffer(inBuffer, residualBuffer, 0, 0, residualSize);
             convolve(layer.filter_size,
                      layer.channels,
                      layer.outputs,
+                     batch_size,
                      inBuffer,
                      tmpBuffer,
                      mergeBuffer,
@@ -455,6 +645,7 @@ void OpenCL_Network::forward(const std::vector<float>& input,
             std::swap(inBuffer, tmpBuffer);
             batchnorm(layer.outputs,
                       361,
+                      batch_size,
                       inBuffer,
                       tmpBuffer,
                       nullptr,
@@ -463,6 +654,7 @@ void OpenCL_Network::forward(const std::vector<float>& input,
             convolve(layer.filter_size,
                      layer.channels,
                      layer.outputs,
+                     batch_size,
                      inBuffer,
                      tmpBuffer,
                      mergeBuffer,
@@ -470,6 +662,7 @@ void OpenCL_Network::forward(const std::vector<float>& input,
             std::swap(inBuffer, tmpBuffer);
             batchnorm(layer.outputs,
                       361,
+                      batch_size,
                       inBuffer,
                       tmpBuffer,
                       &residualBuffer,
@@ -480,6 +673,7 @@ void OpenCL_Network::forward(const std::vector<float>& input,
             convolve(layer.filter_size,
                      layer.channels,
                      layer.outputs,
+                     batch_size,
                      inBuffer,
                      tmpBuffer,
                      mergeBuffer,
@@ -488,13 +682,248 @@ void OpenCL_Network::forward(const std::vector<float>& input,
         }
     }
 
-    queue.enqueueCopyBuffer(inBuffer, outBuffer, 0, 0, finalSize);
-    queue.enqueueReadBuffer(outBuffer, CL_FALSE, 0, finalSize, output.data());
+    // Policy head: 1x1 convolution, batchnorm, then a fully connected
+    // layer to the move logits.
+    auto tower_outputs = m_layers.back().outputs;
+    auto pol_conv = std::vector<cl::Buffer>(begin(m_policy_head.weights),
+                                            begin(m_policy_head.weights) + 2);
+    auto pol_bn   = std::vector<cl::Buffer>(begin(m_policy_head.weights) + 2,
+                                            begin(m_policy_head.weights) + 4);
+    auto pol_ip   = std::vector<cl::Buffer>(begin(m_policy_head.weights) + 4,
+                                            begin(m_policy_head.weights) + 6);
+    convolve(1, tower_outputs, m_policy_head.outputs, batch_size,
+             inBuffer, tmpBuffer, mergeBuffer, pol_conv);
+    batchnorm(m_policy_head.outputs, 361, batch_size,
+              tmpBuffer, residualBuffer, nullptr, pol_bn);
+    innerproduct(m_policy_head.outputs * 361, Network::NET_OUTPUTS - 1,
+                 false, 0, batch_size, residualBuffer, outBuffer, pol_ip);
+
+    // Value head: the same up to a hidden layer with ReLU, then a
+    // single output. The tanh is left to the host.
+    auto val_conv = std::vector<cl::Buffer>(begin(m_value_head.weights),
+                                            begin(m_value_head.weights) + 2);
+    auto val_bn   = std::vector<cl::Buffer>(begin(m_value_head.weights) + 2,
+                                            begin(m_value_head.weights) + 4);
+    auto val_ip1  = std::vector<cl::Buffer>(begin(m_value_head.weights) + 4,
+                                            begin(m_value_head.weights) + 6);
+    auto val_ip2  = std::vector<cl::Buffer>(begin(m_value_head.weights) + 6,
+                                            begin(m_value_head.weights) + 8);
+    convolve(1, tower_outputs, m_value_head.outputs, batch_size,
+             inBuffer, tmpBuffer, mergeBuffer, val_conv);
+    batchnorm(m_value_head.outputs, 361, batch_size,
+              tmpBuffer, residualBuffer, nullptr, val_bn);
+    innerproduct(m_value_head.outputs * 361, m_value_head.hidden_outputs,
+                 true, -1, batch_size, residualBuffer, tmpBuffer, val_ip1);
+    innerproduct(m_value_head.hidden_outputs, 1,
+                 false, Network::NET_OUTPUTS - 1, batch_size,
+                 tmpBuffer, outBuffer, val_ip2);
+
+    // The queue is in order, so the next pass can not touch the shared
+    // buffers before this read is done.
+    cl::Event read_done;
+    queue.enqueueReadBuffer(outBuffer, CL_FALSE, 0, finalSize,
+                            pass.m_output.data(), nullptr, &read_done);
+    pass.m_done = false;
+    pass.m_busy = true;
+    pass.m_on_done = std::move(on_done);
+    read_done.setCallback(CL_COMPLETE, forward_done, &pass);
+    queue.flush();
+
+    return slot;
+}
+
+bool OpenCL_Network::forward_ready(int slot) {
+    auto & pass = opencl_thread_data.m_passes[slot];
+    std::lock_guard<std::mutex> lock(pass.m_mutex);
+    return pass.m_done;
+}
+
+void OpenCL_Network::forward_wait(int slot, std::vector<float>& output) {
+    auto & pass = opencl_thread_data.m_passes[slot];
+    assert(pass.m_busy);
+    {
+        std::unique_lock<std::mutex> lock(pass.m_mutex);
+        pass.m_condvar.wait(lock, [&pass]{ return pass.m_done; });
+    }
+    assert(output.size() >= pass.m_output.size());
+    std::copy(begin(pass.m_output), end(pass.m_output), begin(output));
+    pass.m_busy = false;
+}
+
+static const std::string TUNING_FILE = "leelaz_opencl_tuning";
+
+/*
+    Whether the work groups and their local memory fit on the device.
+*/
+bool OpenCL_Network::tuning_fits(const TuneParams & params) const {
+    auto device = cl::Device::getDefault();
+    auto local_mem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+    auto tower_outputs = int(m_layers.back().outputs);
+
+    auto fits = [&](int filter_size, int channel_group, int output_group) {
+        auto group_size = size_t(channel_group * output_group);
+        if (group_size > opencl.m_max_workgroup_size
+            || size_t(channel_group) > opencl.m_max_workgroup_dims[0]
+            || size_t(output_group) > opencl.m_max_workgroup_dims[1]) {
+            return false;
+        }
+        // The global size has to be a multiple of the local size
+        if (tower_outputs % output_group != 0) {
+            return false;
+        }
+        auto strip_size = (filter_size == 3) ? 3 * (19 + 2) : 19;
+        auto row_buffer = std::min(channel_group, 7);
+        auto local_size = (strip_size * channel_group
+                           + group_size * row_buffer) * sizeof(float);
+        return local_size <= local_mem;
+    };
+
+    return fits(3, params.channel_group, params.output_group)
+        && fits(1, params.conv1_channel_group, params.conv1_output_group);
+}
+
+std::string OpenCL_Network::get_tuning_key() {
+    auto residual_blocks = std::count_if(begin(m_layers), end(m_layers),
+        [](const Layer & layer) { return layer.is_residual_block; });
+    auto ss = std::stringstream{};
+    ss << opencl.get_device_name() << " | "
+       << m_layers.front().channels << " inputs, "
+       << m_layers.back().outputs << " channels, "
+       << residual_blocks << " blocks";
+    return ss.str();
+}
+
+/*
+    The tuning file has a line per device and network:
+    row_tiles channel_group output_group conv1_channel_group
+    conv1_output_group key
+*/
+bool OpenCL_Network::load_tuning(const std::string & key) {
+    auto file = std::ifstream{TUNING_FILE};
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+        auto params = TuneParams{};
+        auto iss = std::istringstream{line};
+        auto line_key = std::string{};
+        iss >> params.row_tiles
+            >> params.channel_group >> params.output_group
+            >> params.conv1_channel_group >> params.conv1_output_group;
+        std::getline(iss, line_key);
+        boost::algorithm::trim(line_key);
+        if (iss && line_key == key && tuning_fits(params)) {
+            m_tuning = params;
+            return true;
+        }
+    }
+    return false;
+}
+
+void OpenCL_Network::save_tuning(const std::string & key) {
+    auto file = std::ofstream{TUNING_FILE, std::ios::app};
+    file << m_tuning.row_tiles << " "
+         << m_tuning.channel_group << " "
+         << m_tuning.output_group << " "
+         << m_tuning.conv1_channel_group << " "
+         << m_tuning.conv1_output_group << " "
+         << key << std::endl;
+    if (!file) {
+        myprintf("Could not write the tuning file %s.\n",
+                 TUNING_FILE.c_str());
+    }
+}
 
-    queue.finish();
+/*
+    Seconds per forward pass with the given parameters, or the largest
+    double if the device refuses them.
+*/
+double OpenCL_Network::time_forward(const TuneParams & params) {
+    constexpr int runs = 10;
+    auto input = std::vector<uint32>(Network::PACKED_INPUT_WORDS);
+    auto output = std::vector<float>(Network::NET_OUTPUTS);
+
+    m_tuning = params;
+    // The merge buffer size depends on the channel groups
+    opencl_thread_data.m_batch_size = 0;
+    try {
+        // The first pass allocates the buffers, leave it out
+        forward(input, output);
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < runs; i++) {
+            forward(input, output);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double>(elapsed).count() / runs;
+    } catch (const cl::Error &) {
+        opencl_thread_data.m_commandqueue.finish();
+        return std::numeric_limits<double>::max();
+    }
+}
+
+void OpenCL_Network::tune() {
+    auto key = get_tuning_key();
+    if (load_tuning(key)) {
+        myprintf("Loaded OpenCL tuning for %s.\n", key.c_str());
+    } else {
+        myprintf("Tuning OpenCL kernels for %s...\n", key.c_str());
+        auto best = TuneParams{};
+        auto best_time = std::numeric_limits<double>::max();
+        auto try_params = [&](const TuneParams & params) {
+            if (!tuning_fits(params)) {
+                return;
+            }
+            auto time = time_forward(params);
+            if (time < best_time) {
+                best_time = time;
+                best = params;
+            }
+        };
+
+        // The 3x3 convolutions are most of the work, tune them first
+        // and the 1x1 ones in the heads with the result.
+        for (auto row_tiles : {1, 2, 3, 4, 5, 7, 10, 19}) {
+            for (auto channel_group : {2, 8}) {
+                for (auto output_group : {8, 16, 32}) {
+                    auto params = best;
+                    params.row_tiles = row_tiles;
+                    params.channel_group = channel_group;
+                    params.output_group = output_group;
+                    try_params(params);
+                }
+            }
+        }
+        auto conv3_best = best;
+        for (auto channel_group : {2, 8}) {
+            for (auto output_group : {8, 16, 32}) {
+                auto params = conv3_best;
+                params.conv1_channel_group = channel_group;
+                params.conv1_output_group = output_group;
+                try_params(params);
+            }
+        }
+        if (best_time == std::numeric_limits<double>::max()) {
+            throw std::runtime_error("No OpenCL kernel parameters "
+                                     "work on this device.");
+        }
+        m_tuning = best;
+        myprintf("Best forward pass: %.3f ms\n", best_time * 1000.0);
+        save_tuning(key);
+    }
+
+    if (cfg_rowtiles) {
+        m_tuning.row_tiles = cfg_rowtiles;
+    }
+    // Reallocate the buffers for the final parameters
+    opencl_thread_data.m_batch_size = 0;
+
+    myprintf("Row tiles: %d, channel/output groups: %d/%d, "
+             "1x1: %d/%d\n",
+             m_tuning.row_tiles,
+             m_tuning.channel_group, m_tuning.output_group,
+             m_tuning.conv1_channel_group, m_tuning.conv1_output_group);
 }
 
 void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
+                              size_t batch_size,
                               cl::Buffer& bufferInput,
                               cl::Buffer& bufferOutput,
                               cl::Buffer& bufferMerge,
@@ -513,23 +942,20 @@ void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
     }
 
     // Input channel grouping
-    int channelGroup = 8;
-    int channelShift = 3;
-    // Input layer is not a multiple of 8
-    if (channels == 18) {
-        channelGroup = 2;
-        channelShift = 1;
-    }
+    int channelGroup = get_channel_group(filter_size, channels);
+    int channelShift = (channelGroup == 8) ? 3 : 1;
 
     constexpr int rowGroup = 1;
-    size_t outputGroup = std::min(outputs, 32);
+    size_t outputGroup = std::min(outputs, (filter_size == 3)
+                                           ? m_tuning.output_group
+                                           : m_tuning.conv1_output_group);
 
 #ifndef NDEBUG
     // Total output size after reducing
     size_t outSize = width * height * outputs * sizeof(float);
 
     // Produce channel * output planes and merge them at the end
-    size_t mergeSize = (channels >> channelShift) * outSize;
+    size_t mergeSize = (channels >> channelShift) * outSize * batch_size;
 #endif
 
     // Copy the rows locally
@@ -538,14 +964,15 @@ void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
     int rowTiles;
     if (filter_size == 3) {
         stripSize = filter_size * (width + (filter_size - 1)) * sizeof(float);
-        rowTiles    =  cfg_rowtiles;
+        rowTiles    =  m_tuning.row_tiles;
         rowTileSize =  (19 + rowTiles - 1) / rowTiles;
+        // The kernel works out the tile count the same way
+        rowTiles    =  (19 + rowTileSize - 1) / rowTileSize;
     } else {
         assert(filter_size == 1);
         stripSize = width * sizeof(float);
         rowTiles    = 19;
         rowTileSize =  1;
-        assert(channelGroup == 8); // hardcoded in kernel
     }
 
     int rowBuffer = std::min<int>(channelGroup, 7);
@@ -566,10 +993,15 @@ void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
             m_convolve_kernel->setArg(6, rowBuffer);
             m_convolve_kernel->setArg(7, channelGroup);
             m_convolve_kernel->setArg(8, channelShift);
+        } else {
+            m_convolve_kernel->setArg(5, rowBuffer);
+            m_convolve_kernel->setArg(6, channelGroup);
+            m_convolve_kernel->setArg(7, channelShift);
         }
 
         queue.enqueueNDRangeKernel(*m_convolve_kernel, cl::NullRange,
-                                   cl::NDRange(channels, outputs, rowTiles),
+                                   cl::NDRange(channels, outputs,
+                                               rowTiles * batch_size),
                                    cl::NDRange(channelGroup, outputGroup, rowGroup));
     } catch (const cl::Error &e) {
         std::cerr << "Error in convolve: " << e.what() << ": "
@@ -587,7 +1019,7 @@ void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
         merge_kernel.setArg(3, channels >> channelShift);
 
         queue.enqueueNDRangeKernel(merge_kernel, cl::NullRange,
-                                   cl::NDRange(outputs, boardsize),
+                                   cl::NDRange(outputs, boardsize * batch_size),
                                    cl::NDRange(std::min(8, outputs), 19));
     } catch (const cl::Error &e) {
         std::cerr << "Error in merge: " << e.what() << ": "
@@ -596,8 +1028,72 @@ void OpenCL_Network::convolve(int filter_size, int channels, int outputs,
     }
 }
 
+/*
+    Fully connected layer. With out_offset -1 the outputs of every
+    position are packed together, otherwise they are written from
+    out_offset on into a row of Network::NET_OUTPUTS per position.
+*/
+void OpenCL_Network::innerproduct(int inputs, int outputs,
+                                  bool relu, int out_offset,
+                                  size_t batch_size,
+                                  cl::Buffer& input,
+                                  cl::Buffer& output,
+                                  std::vector<cl::Buffer>& weights) {
+    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+
+    cl::Kernel & innerproduct_kernel = opencl_thread_data.m_innerproduct_kernel;
+
+    auto out_stride = outputs;
+    if (out_offset >= 0) {
+        out_stride = Network::NET_OUTPUTS;
+    } else {
+        out_offset = 0;
+    }
+
+    try {
+        innerproduct_kernel.setArg(0, input);
+        innerproduct_kernel.setArg(1, output);
+        innerproduct_kernel.setArg(2, weights[0]);
+        innerproduct_kernel.setArg(3, weights[1]);
+        innerproduct_kernel.setArg(4, inputs);
+        innerproduct_kernel.setArg(5, int(relu));
+        innerproduct_kernel.setArg(6, out_offset);
+        innerproduct_kernel.setArg(7, out_stride);
+
+        queue.enqueueNDRangeKernel(innerproduct_kernel, cl::NullRange,
+                                   cl::NDRange(outputs, batch_size));
+    } catch (const cl::Error &e) {
+        std::cerr << "Error in innerproduct: " << e.what() << ": "
+            << e.err() << std::endl;
+        throw;
+    }
+}
+
+void OpenCL_Network::unpack_input(size_t batch_size,
+                                  cl::Buffer& packed,
+                                  cl::Buffer& output) {
+    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+
+    cl::Kernel & unpack_kernel = opencl_thread_data.m_unpack_kernel;
+
+    try {
+        unpack_kernel.setArg(0, packed);
+        unpack_kernel.setArg(1, output);
+
+        queue.enqueueNDRangeKernel(unpack_kernel, cl::NullRange,
+                                   cl::NDRange(19 * 19,
+                                               m_layers.front().channels,
+                                               batch_size));
+    } catch (const cl::Error &e) {
+        std::cerr << "Error in unpack_input: " << e.what() << ": "
+            << e.err() << std::endl;
+        throw;
+    }
+}
+
 void OpenCL_Network::batchnorm(int outputs,
                                int channel_size,
+                               size_t batch_size,
                                cl::Buffer& bufferInput,
                                cl::Buffer& bufferOutput,
                                cl::Buffer* bufferResidual,
@@ -621,9 +1117,11 @@ void OpenCL_Network::batchnorm(int outputs,
         }
         batchnorm_kernel.setArg(3, weights[0]);
         batchnorm_kernel.setArg(4, weights[1]);
+        batchnorm_kernel.setArg(5, channel_size);
 
         queue.enqueueNDRangeKernel(batchnorm_kernel, cl::NullRange,
-                                   cl::NDRange(outputs, channel_size),
+                                   cl::NDRange(outputs,
+                                               channel_size * batch_size),
                                    cl::NDRange(std::min(8, outputs), channelGroup));
     } catch (const cl::Error &e) {
         std::cerr << "Error in batchnorm: " << e.what() << ": "
@@ -650,6 +1148,80 @@ static std::string trim(std::string trim_me) {
     return trim_me;
 }
 
+/*
+    Compiled programs are cached in the working directory. The file
+    starts with a line naming the device, driver and a hash of the
+    source and build options, the binary follows.
+*/
+static std::string get_program_key(const cl::Device & device,
+                                   const std::string & source,
+                                   const std::string & options) {
+    auto ss = std::stringstream{};
+    ss << trim(device.getInfo<CL_DEVICE_NAME>()) << " | "
+       << trim(device.getInfo<CL_DRIVER_VERSION>()) << " | "
+       << std::hex << std::hash<std::string>()(source + options);
+    return ss.str();
+}
+
+static std::string get_program_file(const std::string & key) {
+    auto ss = std::stringstream{};
+    ss << "leelaz_opencl_" << std::hex << std::hash<std::string>()(key)
+       << ".bin";
+    return ss.str();
+}
+
+static bool load_program(const std::string & key,
+                         const cl::Context & context,
+                         const cl::Device & device,
+                         const std::string & options,
+                         cl::Program & program) {
+    auto file = std::ifstream{get_program_file(key), std::ios::binary};
+    auto file_key = std::string{};
+    if (!std::getline(file, file_key) || file_key != key) {
+        return false;
+    }
+    auto binary = std::vector<unsigned char>(
+        std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>());
+    if (binary.empty()) {
+        return false;
+    }
+    try {
+        program = cl::Program(context, {device}, {binary});
+        program.build(options.c_str());
+    } catch (const cl::Error &) {
+        // Stale or corrupted, the caller builds from source
+        return false;
+    }
+    return true;
+}
+
+static void save_program(const std::string & key,
+                         const cl::Program & program) {
+    auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+    if (binaries.size() != 1 || binaries[0].empty()) {
+        return;
+    }
+    // Several engines can start at once, make the file appear
+    // in one go.
+    auto filename = get_program_file(key);
+    auto tmp_filename = filename + "." + std::to_string(std::random_device{}());
+    {
+        auto file = std::ofstream{tmp_filename, std::ios::binary};
+        file << key << '\n';
+        file.write(reinterpret_cast<const char*>(binaries[0].data()),
+                   binaries[0].size());
+        if (!file) {
+            file.close();
+            std::remove(tmp_filename.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+    }
+}
+
 void OpenCL::initialize(void) {
     std::vector<cl::Platform> platforms;
     try {
@@ -758,22 +1330,38 @@ void OpenCL::initialize(void) {
     //std::string sourceCode(std::istreambuf_iterator<char>(sourceFile),
     //                       (std::istreambuf_iterator<char>()));
 
-    // Make program of the source code in the context
-    try {
-        m_program = cl::Program(sourceCode_convolve1
-                                + sourceCode_convolve3
-                                + sourceCode_utility);
-    } catch (const cl::Error &e) {
-        myprintf("Error getting kernels: %s: %d", e.what(), e.err());
-        throw;
-    }
-    // Build program for these specific devices
-    try {
-        m_program.build("-cl-mad-enable -cl-fast-relaxed-math -cl-no-signed-zeros -cl-denorms-are-zero");
-    } catch (const cl::Error&) {
-        myprintf("Error building kernels: %s\n",
-                    m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cl::Device::getDefault()).c_str());
-        throw;
+    auto sourceCode = sourceCode_convolve1
+                      + sourceCode_convolve3
+                      + sourceCode_utility;
+    auto buildOptions = std::string{"-cl-mad-enable -cl-fast-relaxed-math "
+                                    "-cl-no-signed-zeros -cl-denorms-are-zero"};
+    auto programKey = get_program_key(best_device, sourceCode, buildOptions);
+
+    if (load_program(programKey, context, best_device, buildOptions,
+                     m_program)) {
+        myprintf("Loaded compiled kernels from %s\n",
+                 get_program_file(programKey).c_str());
+    } else {
+        // Make program of the source code in the context
+        try {
+            m_program = cl::Program(sourceCode);
+        } catch (const cl::Error &e) {
+            myprintf("Error getting kernels: %s: %d", e.what(), e.err());
+            throw;
+        }
+        // Build program for these specific devices
+        try {
+            m_program.build(buildOptions.c_str());
+        } catch (const cl::Error&) {
+            myprintf("Error building kernels: %s\n",
+                        m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(cl::Device::getDefault()).c_str());
+            throw;
+        }
+        try {
+            save_program(programKey, m_program);
+        } catch (const cl::Error&) {
+            // Not fatal, the next start builds from source again
+        }
     }
 
     ensure_thread_initialized();
@@ -26,6 +26,10 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/cl2.hpp>
 
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -35,15 +39,41 @@ private:
     unsigned int channels{0};
     unsigned int outputs{0};
     unsigned int filter_size{0};
+    // Width of the fully connected hidden layer in the value head
+    unsigned int hidden_outputs{0};
     bool is_batchnorm{false};
     bool is_innerproduct{false};
     bool is_residual_block{false};
     std::vector<cl::Buffer> weights;
 };
 
+/*
+    A forward pass that has been queued but not collected yet. It
+    keeps the host side copies the queue reads from and writes to.
+*/
+class InFlight {
+    friend class OpenCL_Network;
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    bool m_done{false};
+    bool m_busy{false};
+    // Called from the OpenCL runtime once the pass is done
+    std::function<void()> m_on_done;
+    cl::Buffer m_packedBuffer;
+    cl::Buffer m_inBuffer;
+    std::vector<uint32> m_input;
+    std::vector<float> m_output;
+    // Positions m_inBuffer has room for
+    size_t m_batch_size{0};
+};
+
 class ThreadData {
     friend class OpenCL;
     friend class OpenCL_Network;
+public:
+    // Forward passes that can be in flight at once
+    static constexpr int PIPELINE_DEPTH = 2;
 private:
     bool m_is_initialized{false};
     cl::CommandQueue m_commandqueue;
@@ -51,12 +81,31 @@ private:
     cl::Kernel m_convolve3_kernel;
     cl::Kernel m_merge_kernel;
     cl::Kernel m_batchnorm_kernel;
-    cl::Buffer m_inBuffer;
+    cl::Kernel m_innerproduct_kernel;
+    cl::Kernel m_unpack_kernel;
     cl::Buffer m_tmpBuffer;
     cl::Buffer m_mergeBuffer;
-    cl::Buffer m_outBuffer;
     cl::Buffer m_residualBuffer;
-    bool m_buffers_allocated{false};
+    cl::Buffer m_outBuffer;
+    // Positions the buffers have room for
+    size_t m_batch_size{0};
+    std::array<InFlight, PIPELINE_DEPTH> m_passes;
+    int m_next_pass{0};
+};
+
+/*
+    Kernel launch parameters that depend on the device. The tuner
+    picks them by timing the loaded network, see OpenCL_Network::tune.
+*/
+struct TuneParams {
+    // Tiles the board rows are split into by convolve3
+    int row_tiles{5};
+    // Input channels and outputs a convolve3 work group handles
+    int channel_group{8};
+    int output_group{32};
+    // The same for the 1x1 convolutions in the heads
+    int conv1_channel_group{8};
+    int conv1_output_group{32};
 };
 
 class OpenCL_Network {
@@ -110,27 +159,106 @@ public:
             / (biases_1.size() * filter_size * filter_size);
     }
 
+    /*
+        The heads run after the tower, on its output. Together they
+        produce Network::NET_OUTPUTS floats per position.
+    */
+    void push_policy_head(const std::vector<float> & conv_weights,
+                          const std::vector<float> & conv_biases,
+                          const std::vector<float> & bn_means,
+                          const std::vector<float> & bn_variances,
+                          const std::vector<float> & ip_weights,
+                          const std::vector<float> & ip_biases) {
+        for (auto weights : {&conv_weights, &conv_biases,
+                             &bn_means, &bn_variances,
+                             &ip_weights, &ip_biases}) {
+            add_weights(m_policy_head, weights->size(), weights->data());
+        }
+        m_policy_head.outputs = conv_biases.size();
+    }
+
+    void push_value_head(const std::vector<float> & conv_weights,
+                         const std::vector<float> & conv_biases,
+                         const std::vector<float> & bn_means,
+                         const std::vector<float> & bn_variances,
+                         const std::vector<float> & ip1_weights,
+                         const std::vector<float> & ip1_biases,
+                         const std::vector<float> & ip2_weights,
+                         const std::vector<float> & ip2_biases) {
+        for (auto weights : {&conv_weights, &conv_biases,
+                             &bn_means, &bn_variances,
+                             &ip1_weights, &ip1_biases,
+                             &ip2_weights, &ip2_biases}) {
+            add_weights(m_value_head, weights->size(), weights->data());
+        }
+        m_value_head.outputs = conv_biases.size();
+        m_value_head.hidden_outputs = ip1_biases.size();
+    }
+
     size_t get_layer_count() const {
         return m_layers.size();
     }
 
-    void forward(const std::vector<float>& input, std::vector<float>& output);
+    /*
+        Run batch_size positions through the network in one go. input
+        holds them one after the other, packed by Network::pack_input.
+        output gets Network::NET_OUTPUTS floats per position.
+    */
+    void forward(const std::vector<uint32>& input, std::vector<float>& output,
+                 size_t batch_size = 1);
+
+    /*
+        Queue a forward pass and return without waiting for the device.
+        Returns a slot to collect the output from with forward_wait.
+        Every thread can have ThreadData::PIPELINE_DEPTH passes in
+        flight, the oldest has to be collected before queueing another.
+        on_done, if given, is called from a runtime thread once the
+        pass is done, so forward_wait will not block.
+    */
+    int forward_async(const std::vector<uint32>& input, size_t batch_size = 1,
+                      std::function<void()> on_done = nullptr);
+    bool forward_ready(int slot);
+    void forward_wait(int slot, std::vector<float>& output);
+
+    /*
+        Pick the kernel launch parameters for the loaded network. They
+        are looked up in the tuning file first, keyed by device and
+        network shape, and only timed on the device when missing.
+    */
+    void tune();
 
 private:
     void push_weights(size_t layer, const std::vector<float> & weights) {
         add_weights(layer, weights.size(), weights.data());
     }
     void add_weights(size_t layer, size_t size, const float * weights);
+    void add_weights(Layer & layer, size_t size, const float * weights);
+    static void CL_CALLBACK forward_done(cl_event event, cl_int status,
+                                         void * data);
+    size_t get_merge_size() const;
+    int get_channel_group(int filter_size, int channels) const;
+    bool tuning_fits(const TuneParams & params) const;
+    std::string get_tuning_key();
+    bool load_tuning(const std::string & key);
+    void save_tuning(const std::string & key);
+    double time_forward(const TuneParams & params);
     void convolve(int filter_size, int channels, int outputs,
+                  size_t batch_size,
                   cl::Buffer& input, cl::Buffer& output, cl::Buffer& merge,
                   std::vector<cl::Buffer>& weights);
-    void batchnorm(int outputs, int channel_size, cl::Buffer& input,
-                   cl::Buffer& output, cl::Buffer* residual,
+    void unpack_input(size_t batch_size,
+                      cl::Buffer& packed, cl::Buffer& output);
+    void batchnorm(int outputs, int channel_size, size_t batch_size,
+                   cl::Buffer& input, cl::Buffer& output, cl::Buffer* residual,
                    std::vector<cl::Buffer>& weights);
-    void innerproduct(int inputs, int outputs,
+    void innerproduct(int inputs, int outputs, bool relu, int out_offset,
+                      size_t batch_size,
                       cl::Buffer& input, cl::Buffer& output,
                       std::vector<cl::Buffer>& weights);
     std::vector<Layer> m_layers;
+    Layer m_policy_head;
+    Layer m_value_head;
+    TuneParams m_tuning;
 };
 
 class OpenCL {
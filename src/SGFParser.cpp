@@ -24,10 +24,118 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
+#include <iterator>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "Utils.h"
 #include "SGFParser.h"
 
+SGFFile::SGFFile(const std::string& filename) {
+#ifdef _WIN32
+    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    if (ins.fail()) {
+        throw std::runtime_error("Error opening file");
+    }
+    m_contents.assign(std::istreambuf_iterator<char>(ins),
+                      std::istreambuf_iterator<char>());
+    m_data = m_contents.data();
+    m_size = m_contents.size();
+#else
+    auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Error opening file");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Error opening file");
+    }
+    m_size = st.st_size;
+    // mmap refuses empty files
+    if (m_size > 0) {
+        auto map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Error mapping file");
+        }
+        m_data = static_cast<const char*>(map);
+    }
+    close(fd);
+#endif
+    index_games();
+}
+
+SGFFile::~SGFFile() {
+#ifndef _WIN32
+    if (m_data) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+}
+
+boost::string_ref SGFFile::get_game(size_t index) const {
+    if (index >= m_games.size()) {
+        throw std::runtime_error("No such game in file");
+    }
+    return boost::string_ref(m_data + m_games[index].first,
+                             m_games[index].second);
+}
+
+void SGFFile::index_games() {
+    int nesting = 0;      // parentheses
+    bool intag = false;   // brackets
+    int line = 0;
+    auto game_start = size_t{0};
+
+    auto pos = size_t{0};
+    while (pos < m_size) {
+        auto c = m_data[pos++];
+        if (c == '\n') line++;
+
+        if (c == '\\') {
+            // literal char, skip special char parsing
+            pos = std::min(pos + 1, m_size);
+            continue;
+        }
+
+        if (c == '(' && !intag) {
+            if (nesting == 0) {
+                // eat ; too
+                while (pos < m_size && std::isspace(m_data[pos])) {
+                    pos++;
+                }
+                pos = std::min(pos + 1, m_size);
+                game_start = pos;
+            }
+            nesting++;
+        } else if (c == ')' && !intag) {
+            nesting--;
+
+            if (nesting == 0) {
+                m_games.emplace_back(game_start, pos - game_start);
+            }
+        } else if (c == '[' && !intag) {
+            intag = true;
+        } else if (c == ']') {
+            if (intag == false) {
+                Utils::myprintf("Tag error on line %d", line);
+            }
+            intag = false;
+        }
+    }
+
+    // No game found? Assume closing tag was missing (OGS)
+    if (m_games.empty()) {
+        m_games.emplace_back(game_start, m_size - game_start);
+    }
+}
+
 std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
                                                 size_t stopat) {
     std::vector<std::string> result;
@@ -88,84 +196,102 @@ std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
 
 std::vector<std::string> SGFParser::chop_all(std::string filename,
                                              size_t stopat) {
-    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    SGFFile sgf_file(filename);
 
-    if (ins.fail()) {
-        throw std::runtime_error("Error opening file");
+    // chop_stream stops after game stopat
+    auto games = std::min(sgf_file.size(), stopat == SIZE_MAX
+                                           ? SIZE_MAX : stopat + 1);
+    std::vector<std::string> result;
+    result.reserve(games);
+    for (auto i = size_t{0}; i < games; i++) {
+        result.emplace_back(sgf_file.get_game(i).to_string());
     }
 
-    auto result = chop_stream(ins, stopat);
-    ins.close();
-
     return result;
 }
 
 // scan the file and extract the game with number index
 std::string SGFParser::chop_from_file(std::string filename, size_t index) {
-    auto vec = chop_all(filename, index);
-    return vec[index];
+    SGFFile sgf_file(filename);
+    return sgf_file.get_game(index).to_string();
 }
 
-std::string SGFParser::parse_property_name(std::istringstream & strm) {
-    std::string result;
-
-    char c;
-    while (strm >> c) {
-        // SGF property names are guaranteed to be uppercase,
-        // except that some implementations like IGS are retarded
-        // and don't folow the spec. So allow both upper/lowercase.
-        if (!std::isupper(c) && !std::islower(c)) {
-            strm.unget();
-            break;
-        } else {
-            result.push_back(c);
-        }
+boost::string_ref SGFParser::parse_property_name(boost::string_ref buffer,
+                                                 size_t & pos) {
+    auto start = pos;
+    // SGF property names are guaranteed to be uppercase,
+    // except that some implementations like IGS are retarded
+    // and don't folow the spec. So allow both upper/lowercase.
+    while (pos < buffer.size()
+           && (std::isupper(buffer[pos]) || std::islower(buffer[pos]))) {
+        pos++;
     }
 
-    return result;
+    return buffer.substr(start, pos - start);
 }
 
-bool SGFParser::parse_property_value(std::istringstream & strm,
-                                     std::string & result) {
-    strm >> std::noskipws;
-
-    char c;
-    while (strm >> c) {
-        if (!std::isspace(c)) {
-            strm.unget();
-            break;
-        }
+// Pass nullptr as result to skip over the value
+bool SGFParser::parse_property_value(boost::string_ref buffer, size_t & pos,
+                                     std::string * result) {
+    while (pos < buffer.size() && std::isspace(buffer[pos])) {
+        pos++;
     }
 
-    strm >> c;
-
-    if (c != '[') {
-        strm.unget();
+    if (pos >= buffer.size() || buffer[pos] != '[') {
         return false;
     }
-
-    while (strm >> c) {
-        if (c == ']') {
-            break;
-        } else if (c == '\\') {
-            strm >> c;
+    pos++;
+
+    auto start = pos;
+    auto escaped = false;
+    while (pos < buffer.size() && buffer[pos] != ']') {
+        if (buffer[pos] == '\\') {
+            escaped = true;
+            pos++;
         }
-        result.push_back(c);
+        pos++;
     }
+    auto end = std::min(pos, buffer.size());
+    // skip the ]
+    pos = std::min(pos + 1, buffer.size());
 
-    strm >> std::skipws;
+    if (result) {
+        if (!escaped) {
+            result->assign(buffer.data() + start, end - start);
+        } else {
+            result->clear();
+            for (auto i = start; i < end; i++) {
+                if (buffer[i] == '\\' && i + 1 < end) {
+                    i++;
+                }
+                result->push_back(buffer[i]);
+            }
+        }
+    }
 
     return true;
 }
 
-void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
+// The properties SGFTree looks at, everything else is skipped
+bool SGFParser::is_used_property(boost::string_ref name) {
+    static const boost::string_ref used[] = {
+        "B", "W", "AB", "AW", "GM", "SZ", "KM", "HA", "RE", "PL"
+    };
+    return std::find(std::begin(used), std::end(used), name)
+           != std::end(used);
+}
+
+void SGFParser::parse(boost::string_ref buffer, SGFTree * node) {
+    auto pos = size_t{0};
+    parse(buffer, pos, node);
+}
+
+void SGFParser::parse(boost::string_ref buffer, size_t & pos,
+                      SGFTree * node) {
     bool splitpoint = false;
 
-    char c;
-    while (strm >> c) {
-        if (strm.fail()) {
-            return;
-        }
+    while (pos < buffer.size()) {
+        auto c = buffer[pos++];
 
         if (std::isspace(c)) {
             continue;
@@ -173,16 +299,19 @@ void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
 
         // parse a property
         if (std::isalpha(c) && std::isupper(c)) {
-            strm.unget();
+            pos--;
 
-            std::string propname = parse_property_name(strm);
+            auto propname = parse_property_name(buffer, pos);
+            auto used = is_used_property(propname);
             bool success;
 
             do {
                 std::string propval;
-                success = parse_property_value(strm, propval);
-                if (success) {
-                    node->add_property(propname, propval);
+                success = parse_property_value(buffer, pos,
+                                               used ? &propval : nullptr);
+                if (success && used) {
+                    node->add_property(propname.to_string(),
+                                       std::move(propval));
                 }
             } while (success);
 
@@ -191,25 +320,24 @@ void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
 
         if (c == '(') {
             // eat first ;
-            char cc;
-            do {
-                strm >> cc;
-            } while (std::isspace(cc));
-            if (cc != ';') {
-                strm.unget();
+            while (pos < buffer.size() && std::isspace(buffer[pos])) {
+                pos++;
+            }
+            if (pos < buffer.size() && buffer[pos] == ';') {
+                pos++;
             }
             // start a variation here
             splitpoint = true;
             // new node
             SGFTree * newptr = node->add_child();
-            parse(strm, newptr);
+            parse(buffer, pos, newptr);
         } else if (c == ')') {
             // variation ends, go back
             // if the variation didn't start here, then
             // push the "variation ends" mark back
             // and try again one level up the tree
             if (!splitpoint) {
-                strm.unget();
+                pos--;
                 return;
             } else {
                 splitpoint = false;
@@ -22,20 +22,63 @@
 #include <string>
 #include <sstream>
 #include <climits>
+#include <utility>
+#include <vector>
+#include <boost/utility/string_ref.hpp>
 
 #include "SGFTree.h"
 
+/*
+    A file of concatenated SGF games, mapped into memory. One pass over
+    it finds where every game starts and ends, after that any game can
+    be looked at without reading or copying the rest of the file.
+    The games are split up the same way chop_stream does it.
+*/
+class SGFFile {
+public:
+    explicit SGFFile(const std::string& filename);
+    ~SGFFile();
+    SGFFile(const SGFFile&) = delete;
+    SGFFile& operator=(const SGFFile&) = delete;
+
+    size_t size() const {
+        return m_games.size();
+    }
+    // Only valid as long as the SGFFile is
+    boost::string_ref get_game(size_t index) const;
+
+private:
+    void index_games();
+
+    const char * m_data{nullptr};
+    size_t m_size{0};
+#ifdef _WIN32
+    // No mmap, the file is read in instead
+    std::string m_contents;
+#endif
+    // Offset and length of every game
+    std::vector<std::pair<size_t, size_t>> m_games;
+};
+
 class SGFParser {
 private:
-    static std::string parse_property_name(std::istringstream & strm);
-    static bool parse_property_value(std::istringstream & strm, std::string & result);
+    static boost::string_ref parse_property_name(boost::string_ref buffer,
+                                                 size_t & pos);
+    static bool parse_property_value(boost::string_ref buffer, size_t & pos,
+                                     std::string * result);
+    static bool is_used_property(boost::string_ref name);
+    static void parse(boost::string_ref buffer, size_t & pos, SGFTree * node);
 public:
     static std::string chop_from_file(std::string fname, size_t index);
     static std::vector<std::string> chop_all(std::string fname,
                                              size_t stopat = SIZE_MAX);
     static std::vector<std::string> chop_stream(std::istream& ins,
                                                 size_t stopat = SIZE_MAX);
-    static void parse(std::istringstream & strm, SGFTree * node);
+    /*
+        Build the tree for a game, as cut out by SGFFile or chop_all.
+        Only the properties SGFTree uses are kept.
+    */
+    static void parse(boost::string_ref buffer, SGFTree * node);
     static int count_games_in_file(std::string filename);
 };
 
@@ -113,11 +113,9 @@ int SGFTree::count_mainline_moves(void) {
     return count;
 }
 
-void SGFTree::load_from_string(std::string gamebuff) {
-    std::istringstream pstream(gamebuff);
-
+void SGFTree::load_from_string(boost::string_ref gamebuff) {
     // loads properties with moves
-    SGFParser::parse(pstream, this);
+    SGFParser::parse(gamebuff, this);
 
     // Set up the root state to defaults
     init_state();
@@ -137,28 +135,28 @@ void SGFTree::load_from_file(std::string filename, int index) {
 }
 
 void SGFTree::populate_states(void) {
-    PropertyMap::iterator it;
+    const std::string * it;
     bool valid_size = false;
     bool has_handicap = false;
 
     // first check for go game setup in properties
-    it = m_properties.find("GM");
-    if (it != m_properties.end()) {
-        if (it->second != "1") {
+    it = find_property("GM");
+    if (it) {
+        if (*it != "1") {
             throw std::runtime_error("SGF Game is not a Go game");
         } else {
-            if (!m_properties.count("SZ")) {
+            if (!find_property("SZ")) {
                 // No size, but SGF spec defines default size for Go
-                m_properties.insert(std::make_pair("SZ", "19"));
+                m_properties.emplace_back("SZ", "19");
                 valid_size = true;
             }
         }
     }
 
     // board size
-    it = m_properties.find("SZ");
-    if (it != m_properties.end()) {
-        std::string size = it->second;
+    it = find_property("SZ");
+    if (it) {
+        std::string size = *it;
         std::istringstream strm(size);
         int bsize;
         strm >> bsize;
@@ -172,9 +170,9 @@ void SGFTree::populate_states(void) {
     }
 
     // komi
-    it = m_properties.find("KM");
-    if (it != m_properties.end()) {
-        std::string foo = it->second;
+    it = find_property("KM");
+    if (it) {
+        std::string foo = *it;
         std::istringstream strm(foo);
         float komi;
         strm >> komi;
@@ -189,9 +187,9 @@ void SGFTree::populate_states(void) {
     }
 
     // handicap
-    it = m_properties.find("HA");
-    if (it != m_properties.end()) {
-        std::string size = it->second;
+    it = find_property("HA");
+    if (it) {
+        std::string size = *it;
         std::istringstream strm(size);
         float handicap;
         strm >> handicap;
@@ -200,9 +198,9 @@ void SGFTree::populate_states(void) {
     }
 
     // result
-    it = m_properties.find("RE");
-    if (it != m_properties.end()) {
-        std::string result = it->second;
+    it = find_property("RE");
+    if (it) {
+        const std::string& result = *it;
         if (boost::algorithm::find_first(result, "Time")) {
             // std::cerr << "Skipping: " << result << std::endl;
             m_winner = FastBoard::EMPTY;
@@ -221,34 +219,34 @@ void SGFTree::populate_states(void) {
     }
 
     // handicap stones
-    auto prop_pair_ab = m_properties.equal_range("AB");
+    const auto* ab_node = this;
     // Do we have a handicap specified but no handicap stones placed in
     // the same node? Then the SGF file is corrupt. Let's see if we can find
     // them in the next node, which is a common bug in some Go apps.
-    if (has_handicap && prop_pair_ab.first == prop_pair_ab.second) {
+    if (has_handicap && !find_property("AB")) {
         if (!m_children.empty()) {
-            auto& successor = m_children[0];
-            prop_pair_ab = successor.m_properties.equal_range("AB");
+            ab_node = &m_children[0];
         }
     }
     // Loop through the stone list and apply
-    for (auto it = prop_pair_ab.first; it != prop_pair_ab.second; ++it) {
-        auto move = it->second;
-        int vtx = string_to_vertex(move);
-        apply_move(FastBoard::BLACK, vtx);
+    for (const auto& prop : ab_node->m_properties) {
+        if (prop.first == "AB") {
+            int vtx = string_to_vertex(prop.second);
+            apply_move(FastBoard::BLACK, vtx);
+        }
     }
 
     // XXX: count handicap stones
-    const auto& prop_pair_aw = m_properties.equal_range("AW");
-    for (auto it = prop_pair_aw.first; it != prop_pair_aw.second; ++it) {
-        auto move = it->second;
-        int vtx = string_to_vertex(move);
-        apply_move(FastBoard::WHITE, vtx);
+    for (const auto& prop : m_properties) {
+        if (prop.first == "AW") {
+            int vtx = string_to_vertex(prop.second);
+            apply_move(FastBoard::WHITE, vtx);
+        }
     }
 
-    it = m_properties.find("PL");
-    if (it != m_properties.end()) {
-        std::string who = it->second;
+    it = find_property("PL");
+    if (it) {
+        const std::string& who = *it;
         if (who == "W") {
             m_state.set_to_move(FastBoard::WHITE);
         } else if (who == "B") {
@@ -299,7 +297,16 @@ void SGFTree::apply_move(int move) {
 }
 
 void SGFTree::add_property(std::string property, std::string value) {
-    m_properties.emplace(property, value);
+    m_properties.emplace_back(std::move(property), std::move(value));
+}
+
+const std::string * SGFTree::find_property(const char * property) const {
+    for (const auto& prop : m_properties) {
+        if (prop.first == property) {
+            return &prop.second;
+        }
+    }
+    return nullptr;
 }
 
 SGFTree * SGFTree::add_child() {
@@ -356,20 +363,10 @@ int SGFTree::string_to_vertex(const std::string& movestring) const {
 }
 
 int SGFTree::get_move(int tomove) {
-    std::string movestring;
-
-    if (tomove == FastBoard::BLACK) {
-        movestring = "B";
-    } else {
-        movestring = "W";
-    }
-
-    PropertyMap::iterator it;
-    it = m_properties.find(movestring);
+    auto it = find_property(tomove == FastBoard::BLACK ? "B" : "W");
 
-    if (it != m_properties.end()) {
-        std::string movestring = it->second;
-        return string_to_vertex(movestring);
+    if (it) {
+        return string_to_vertex(*it);
     }
 
     return SGFTree::EOT;
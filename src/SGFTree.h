@@ -20,9 +20,10 @@
 #define SGFTREE_H_INCLUDED
 
 #include <vector>
-#include <map>
 #include <string>
 #include <sstream>
+#include <utility>
+#include <boost/utility/string_ref.hpp>
 #include "KoState.h"
 #include "GameState.h"
 
@@ -38,7 +39,7 @@ public:
     GameState follow_mainline_state(unsigned int movenum = 999);
     std::vector<int> get_mainline();
     void load_from_file(std::string filename, int index = 0);
-    void load_from_string(std::string gamebuff);
+    void load_from_string(boost::string_ref gamebuff);
 
     int count_mainline_moves(void);
 
@@ -59,8 +60,11 @@ private:
     void apply_move(int move);
     void copy_state(const SGFTree& state);
     int string_to_vertex(const std::string& move) const;
+    const std::string * find_property(const char * property) const;
 
-    using PropertyMap = std::multimap<std::string, std::string>;
+    // Nodes only hold a few properties, in the order they appear.
+    // Names and moves fit in std::string's small buffer.
+    using PropertyMap = std::vector<std::pair<std::string, std::string>>;
 
     bool m_initialized{false};
     KoState m_state;
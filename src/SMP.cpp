@@ -20,6 +20,15 @@
 #include "SMP.h"
 
 #include <thread>
+#include <fstream>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static thread_local int s_thread_node = -1;
 
 SMP::Mutex::Mutex() {
     m_lock = false;
@@ -49,3 +58,112 @@ SMP::Lock::~Lock() {
 int SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+#ifdef __linux__
+// Parse a sysfs cpu list such as "0-3,8-11"
+static std::vector<int> parse_cpulist(const std::string & list) {
+    std::vector<int> cpus;
+    std::istringstream iss(list);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+        auto dash = range.find('-');
+        try {
+            auto first = std::stoi(range.substr(0, dash));
+            auto last = first;
+            if (dash != std::string::npos) {
+                last = std::stoi(range.substr(dash + 1));
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.emplace_back(cpu);
+            }
+        } catch (const std::exception &) {
+            // Malformed entry, skip it
+        }
+    }
+    return cpus;
+}
+
+static bool set_affinity(const std::vector<int> & cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#endif
+
+const std::vector<std::vector<int>> & SMP::get_numa_nodes() {
+    static const auto nodes = [] {
+        std::vector<std::vector<int>> res;
+#ifdef __linux__
+        for (int node = 0; ; node++) {
+            std::ifstream cpulist("/sys/devices/system/node/node"
+                                  + std::to_string(node) + "/cpulist");
+            if (!cpulist) {
+                break;
+            }
+            std::string line;
+            std::getline(cpulist, line);
+            auto cpus = parse_cpulist(line);
+            if (!cpus.empty()) {
+                res.emplace_back(cpus);
+            }
+        }
+#endif
+        if (res.empty()) {
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < get_num_cpus(); cpu++) {
+                cpus.emplace_back(cpu);
+            }
+            res.emplace_back(cpus);
+        }
+        return res;
+    }();
+    return nodes;
+}
+
+bool SMP::bind_thread(int slot) {
+#ifdef __linux__
+    auto & nodes = get_numa_nodes();
+    auto cpu_count = size_t{0};
+    for (auto & node : nodes) {
+        cpu_count += node.size();
+    }
+    auto index = size_t(slot) % cpu_count;
+    for (size_t node = 0; node < nodes.size(); node++) {
+        if (index < nodes[node].size()) {
+            if (!set_affinity({nodes[node][index]})) {
+                return false;
+            }
+            s_thread_node = int(node);
+            return true;
+        }
+        index -= nodes[node].size();
+    }
+#else
+    (void)slot;
+#endif
+    return false;
+}
+
+bool SMP::bind_thread_to_node(int node) {
+#ifdef __linux__
+    auto & nodes = get_numa_nodes();
+    if (node < 0 || size_t(node) >= nodes.size()) {
+        return false;
+    }
+    if (!set_affinity(nodes[node])) {
+        return false;
+    }
+    s_thread_node = node;
+    return true;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+int SMP::get_thread_node() {
+    return s_thread_node;
+}
@@ -21,10 +21,30 @@
 
 #include "config.h"
 #include <atomic>
+#include <vector>
 
 namespace SMP {
     int get_num_cpus();
 
+    /*
+        CPUs of every NUMA node. Without NUMA information this is
+        a single node with all CPUs.
+    */
+    const std::vector<std::vector<int>> & get_numa_nodes();
+
+    /*
+        Pin the calling thread. Slots are handed out node by node, so
+        low slot numbers share a node. Return false if pinning is not
+        supported on this platform.
+    */
+    bool bind_thread(int slot);
+    bool bind_thread_to_node(int node);
+
+    /*
+        NUMA node the calling thread is pinned to, -1 if it is not
+    */
+    int get_thread_node();
+
     class Mutex {
     public:
         Mutex();
@@ -0,0 +1,106 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SelfPlay.h"
+#include "FastBoard.h"
+#include "SGFTree.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+SelfPlay::Output::Output(const std::string& prefix, int total_games,
+                         int compression_level)
+    : m_total_games(total_games),
+      m_chunker(prefix, true, TrainingFormat::TEXT, compression_level),
+      m_sgf(prefix + ".sgf", std::ios::app) {
+}
+
+void SelfPlay::run(int concurrent_games, int total_games,
+                   const std::string& prefix, int compression_level) {
+    Output output{prefix, total_games, compression_level};
+    if (!output.m_sgf) {
+        myprintf("Could not open %s.sgf for writing.\n", prefix.c_str());
+        return;
+    }
+
+    std::vector<std::thread> games;
+    for (int i = 0; i < concurrent_games; i++) {
+        games.emplace_back(play_games, std::ref(output));
+    }
+    for (auto& game : games) {
+        game.join();
+    }
+}
+
+void SelfPlay::play_games(Output& output) {
+    auto game = std::make_unique<GameState>();
+    auto ttable = std::make_unique<TTable>();
+    for (;;) {
+        auto number = ++output.m_games_started;
+        if (output.m_total_games > 0 && number > output.m_total_games) {
+            return;
+        }
+
+        Training::clear_training();
+        auto winner = play_game(*game, *ttable);
+
+        auto sgf = SGFTree::state_to_string(*game, FastBoard::BLACK);
+        std::lock_guard<std::mutex> lock(output.m_mutex);
+        Training::dump_training(winner, output.m_chunker);
+        output.m_sgf << sgf << std::flush;
+        output.m_games_done++;
+        std::printf("Game %d done, %d moves, %s won. %d games played.\n",
+                    number, int(game->get_movenum()),
+                    winner == FastBoard::BLACK ? "black" : "white",
+                    output.m_games_done);
+    }
+}
+
+int SelfPlay::play_game(GameState& game, TTable& ttable) {
+    game.init_game(19, KOMI);
+    ttable.clear();
+    // No time limit, the searches stop at the playout limit
+    game.set_timecontrol(0, 100, 0, 0);
+
+    for (;;) {
+        auto color = game.get_to_move();
+        auto search = std::make_unique<UCTSearch>(game, ttable);
+        auto move = search->think(color);
+        game.play_move(color, move);
+
+        if (move == FastBoard::RESIGN) {
+            return color == FastBoard::BLACK ? FastBoard::WHITE
+                                             : FastBoard::BLACK;
+        }
+        if (game.get_passes() >= 2 || game.get_movenum() > MAX_MOVES) {
+            break;
+        }
+    }
+
+    auto score = game.final_score();
+    return score > 0.0f ? FastBoard::BLACK : FastBoard::WHITE;
+}
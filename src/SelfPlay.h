@@ -0,0 +1,69 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include "config.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include "GameState.h"
+#include "TTable.h"
+#include "Training.h"
+
+class SelfPlay {
+public:
+    /*
+        Play games against ourselves, concurrent_games at a time, each
+        on a thread of its own searching with cfg_num_threads threads.
+        The batching thread started by main serves the network
+        evaluations of all games together. Training data goes to the
+        chunks <prefix>.N.gz, gzipped at compression_level, and the
+        games to <prefix>.sgf.
+        With total_games 0 it keeps playing until killed.
+    */
+    static void run(int concurrent_games, int total_games,
+                    const std::string& prefix, int compression_level);
+
+    static constexpr float KOMI = 7.5f;
+    // Games that get this long are scored, like autogtp does.
+    static constexpr size_t MAX_MOVES = 19 * 19 * 2;
+
+private:
+    // Shared by the games, the outputs guarded by m_mutex
+    struct Output {
+        Output(const std::string& prefix, int total_games,
+               int compression_level);
+
+        std::atomic<int> m_games_started{0};
+        int m_total_games;
+        std::mutex m_mutex;
+        OutputChunker m_chunker;
+        std::ofstream m_sgf;
+        int m_games_done{0};
+    };
+
+    static void play_games(Output& output);
+    // Every game searches with a TTable of its own, cleared before
+    // each game, so it never picks up another game's visits.
+    static int play_game(GameState& game, TTable& ttable);
+};
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "Utils.h"
@@ -33,6 +34,11 @@ TTable::TTable(int size) {
     m_buckets.resize(size);
 }
 
+void TTable::clear(void) {
+    LOCK(m_mutex, lock);
+    std::fill(begin(m_buckets), end(m_buckets), TTEntry());
+}
+
 void TTable::update(uint64 hash, const float komi, const UCTNode * node) {
     LOCK(m_mutex, lock);
 
@@ -35,6 +35,12 @@ public:
 
 class TTable {
 public:
+    /*
+        A table of its own, for searches that must not share the
+        global one, like concurrent self-play games.
+    */
+    TTable(int size = 500000);
+
     /*
         return the global TT
     */
@@ -50,9 +56,12 @@ public:
     */
     void sync(uint64 hash, const float komi, UCTNode * node);
 
-private:
-    TTable(int size = 500000);
+    /*
+        drop all entries
+    */
+    void clear(void);
 
+private:
     SMP::Mutex m_mutex;
     std::vector<TTEntry> m_buckets;
     float m_komi;
@@ -24,55 +24,308 @@
     distribution.
 */
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <exception>
 #include <vector>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <future>
 #include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace Utils {
 
+/*
+    A void() callable with room for small callables inline, so queueing
+    a task does not allocate. Bigger callables fall back to the heap.
+*/
+class Task {
+public:
+    static constexpr std::size_t INLINE_SIZE = 64;
+
+    Task() = default;
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using func_t = typename std::decay<F>::type;
+        using fits_inline = std::integral_constant<bool,
+            sizeof(func_t) <= INLINE_SIZE
+            && alignof(func_t) <= alignof(std::max_align_t)>;
+        construct<func_t>(std::forward<F>(f), fits_inline{});
+    }
+    Task(Task&& other) noexcept {
+        take(other);
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    ~Task() {
+        reset();
+    }
+    void operator()() {
+        m_ops->invoke(&m_storage);
+    }
+
+private:
+    using storage_t = std::aligned_storage<INLINE_SIZE,
+                                           alignof(std::max_align_t)>::type;
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);  /* also destroys src */
+        void (*destroy)(void*);
+    };
+    template<class F>
+    struct InlineOps {
+        static void invoke(void* p) {
+            (*static_cast<F*>(p))();
+        }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) {
+            static_cast<F*>(p)->~F();
+        }
+        static constexpr Ops ops{invoke, move, destroy};
+    };
+    template<class F>
+    struct HeapOps {
+        static void invoke(void* p) {
+            (**static_cast<F**>(p))();
+        }
+        static void move(void* dst, void* src) {
+            new (dst) F*(*static_cast<F**>(src));
+        }
+        static void destroy(void* p) {
+            delete *static_cast<F**>(p);
+        }
+        static constexpr Ops ops{invoke, move, destroy};
+    };
+
+    template<class func_t, class F>
+    void construct(F&& f, std::true_type) {
+        new (&m_storage) func_t(std::forward<F>(f));
+        m_ops = &InlineOps<func_t>::ops;
+    }
+    template<class func_t, class F>
+    void construct(F&& f, std::false_type) {
+        new (&m_storage) func_t*(new func_t(std::forward<F>(f)));
+        m_ops = &HeapOps<func_t>::ops;
+    }
+
+    void take(Task& other) {
+        m_ops = other.m_ops;
+        if (m_ops) {
+            m_ops->move(&m_storage, &other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    storage_t m_storage;
+    const Ops* m_ops{nullptr};
+};
+
+template<class F>
+constexpr Task::Ops Task::InlineOps<F>::ops;
+template<class F>
+constexpr Task::Ops Task::HeapOps<F>::ops;
+
+/*
+    Task deque owned by one worker. The owner pushes and pops at the
+    back, idle workers steal the oldest task from the front. The ring
+    only allocates when it has to grow.
+*/
+class WorkQueue {
+public:
+    WorkQueue() : m_ring(INITIAL_SIZE) {}
+
+    void push(Task&& task) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_size == m_ring.size()) {
+            grow();
+        }
+        m_ring[(m_head + m_size) & (m_ring.size() - 1)] = std::move(task);
+        m_size++;
+    }
+    bool pop(Task& task) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_size == 0) {
+            return false;
+        }
+        m_size--;
+        task = std::move(m_ring[(m_head + m_size) & (m_ring.size() - 1)]);
+        return true;
+    }
+    bool steal(Task& task) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_size == 0) {
+            return false;
+        }
+        task = std::move(m_ring[m_head]);
+        m_head = (m_head + 1) & (m_ring.size() - 1);
+        m_size--;
+        return true;
+    }
+
+private:
+    static constexpr std::size_t INITIAL_SIZE = 64;
+
+    void grow() {
+        std::vector<Task> ring(m_ring.size() * 2);
+        for (std::size_t i = 0; i < m_size; i++) {
+            ring[i] = std::move(m_ring[(m_head + i) & (m_ring.size() - 1)]);
+        }
+        m_ring.swap(ring);
+        m_head = 0;
+    }
+
+    std::mutex m_mutex;
+    std::vector<Task> m_ring;
+    std::size_t m_head{0};
+    std::size_t m_size{0};
+};
+
+/*
+    Work stealing pool. Every worker has its own queue, tasks queued
+    from a worker go to that worker's queue, tasks from other threads
+    are spread round robin. Workers only sleep when all queues are
+    empty.
+*/
 class ThreadPool {
 public:
     ThreadPool() = default;
     ~ThreadPool();
-    void initialize(std::size_t);
+    /*
+        on_start, if given, runs first on every worker with its index
+    */
+    void initialize(std::size_t threads,
+                    std::function<void(std::size_t)> on_start = nullptr);
     template<class F, class... Args>
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+
+    /*
+        queue a task without a future, does not allocate
+    */
+    void push_task(Task&& task);
+
 private:
+    struct Worker {
+        const ThreadPool* pool{nullptr};
+        int index{-1};
+    };
+    static Worker& current_worker();
+    int worker_index() const;
+    bool take_task(Task& task);
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::atomic<std::size_t> m_next_queue{0};
+    std::atomic<std::size_t> m_queued{0};
+    std::atomic<std::size_t> m_sleeping{0};
 
     std::mutex m_mutex;
     std::condition_variable m_condvar;
     bool m_exit{false};
 };
 
-inline void ThreadPool::initialize(size_t threads) {
+inline ThreadPool::Worker& ThreadPool::current_worker() {
+    thread_local Worker s_worker;
+    return s_worker;
+}
+
+/*
+    queue index of the calling thread, -1 if it is not one of our workers
+*/
+inline int ThreadPool::worker_index() const {
+    const auto& worker = current_worker();
+    return worker.pool == this ? worker.index : -1;
+}
+
+inline void ThreadPool::initialize(size_t threads,
+                                   std::function<void(std::size_t)> on_start) {
     for (size_t i = 0; i < threads; i++) {
-        m_threads.emplace_back([this] {
+        m_queues.emplace_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        m_threads.emplace_back([this, i, on_start] {
+            current_worker() = Worker{this, static_cast<int>(i)};
+            if (on_start) {
+                on_start(i);
+            }
             for (;;) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(m_mutex);
-                    m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                    if (m_exit && m_tasks.empty()) {
-                        return;
-                    }
-                    task = std::move(m_tasks.front());
-                    m_tasks.pop();
+                Task task;
+                if (take_task(task)) {
+                    task();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_sleeping++;
+                m_condvar.wait(lock, [this]{ return m_exit || m_queued > 0; });
+                m_sleeping--;
+                if (m_exit && m_queued == 0) {
+                    return;
                 }
-                task();
             }
         });
     }
 }
 
+inline bool ThreadPool::take_task(Task& task) {
+    const auto queues = m_queues.size();
+    if (queues == 0 || m_queued == 0) {
+        return false;
+    }
+    const auto own = worker_index();
+    if (own >= 0 && m_queues[own]->pop(task)) {
+        m_queued--;
+        return true;
+    }
+    const auto first = own >= 0 ? static_cast<size_t>(own) + 1 : 0;
+    for (size_t i = 0; i < queues; i++) {
+        if (m_queues[(first + i) % queues]->steal(task)) {
+            m_queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void ThreadPool::push_task(Task&& task) {
+    if (m_queues.empty()) {
+        // No workers, run it right away.
+        task();
+        return;
+    }
+    auto index = worker_index();
+    if (index < 0) {
+        index = static_cast<int>(m_next_queue++ % m_queues.size());
+    }
+    m_queues[index]->push(std::move(task));
+    // Pairs with the worker bumping m_sleeping before it checks m_queued.
+    m_queued++;
+    if (m_sleeping > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_condvar.notify_one();
+    }
+}
+
 template<class F, class... Args>
 auto ThreadPool::add_task(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
@@ -83,11 +336,7 @@ auto ThreadPool::add_task(F&& f, Args&&... args)
     );
 
     std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
+    push_task([task](){(*task)();});
     return res;
 }
 
@@ -102,25 +351,102 @@ inline ThreadPool::~ThreadPool() {
     }
 }
 
+/*
+    Tasks whose completion can be waited for together. The first
+    exception thrown by a task is rethrown from wait_all. A waiting
+    thread runs the group's own tasks that no worker has started yet,
+    so groups can be nested inside pool tasks, but it never picks up
+    the tasks of other groups sharing the pool.
+*/
 class ThreadGroup {
 public:
-    ThreadGroup(ThreadPool & pool) : m_pool(pool) {};
+    ThreadGroup(ThreadPool & pool)
+        : m_pool(pool), m_state(std::make_shared<State>()) {};
+    ~ThreadGroup() {
+        wait_for_tasks();
+    }
     template<class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            m_state->queued.emplace_back(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+            m_state->pending++;
+        }
+        m_state->condvar.notify_all();
+        // The pool only gets a handle, whoever comes first runs the
+        // task. It can outlive the group, so it shares the state.
+        m_pool.push_task([state = m_state]() {
+            run_queued(*state);
+        });
     };
     void wait_all() {
-        for (auto && result: m_taskresults) {
-            result.get();
+        wait_for_tasks();
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        if (m_state->exception) {
+            auto exception = m_state->exception;
+            m_state->exception = nullptr;
+            std::rethrow_exception(exception);
         }
     };
 private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable condvar;
+        // Tasks nobody has started yet
+        std::vector<Task> queued;
+        // Tasks queued or running
+        int pending{0};
+        std::exception_ptr exception;
+    };
+
+    // Run one of the group's tasks, if there are any left
+    static bool run_queued(State & state) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.queued.empty()) {
+                return false;
+            }
+            task = std::move(state.queued.back());
+            state.queued.pop_back();
+        }
+        std::exception_ptr exception;
+        try {
+            task();
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (exception && !state.exception) {
+            state.exception = exception;
+        }
+        if (--state.pending == 0) {
+            state.condvar.notify_all();
+        }
+        return true;
+    }
+
+    void wait_for_tasks() {
+        auto & state = *m_state;
+        for (;;) {
+            if (run_queued(state)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.condvar.wait(lock, [&state] {
+                return state.pending == 0 || !state.queued.empty();
+            });
+            if (state.pending == 0) {
+                return;
+            }
+        }
+    }
+
     ThreadPool & m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    std::shared_ptr<State> m_state;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -18,36 +18,69 @@
 
 #include "config.h"
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/utility.hpp>
 #include "stdlib.h"
 #include "zlib.h"
-#include "string.h"
 
 #include "Training.h"
 #include "UCTNode.h"
 #include "SGFParser.h"
 #include "SGFTree.h"
 #include "Random.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
-std::vector<TimeStep> Training::m_data{};
+thread_local std::vector<PackedStep> Training::m_data{};
+thread_local std::vector<Training::StoneBoard> Training::m_boards{};
+thread_local std::unordered_map<uint64, uint32> Training::m_board_index{};
 
-std::string OutputChunker::gen_chunk_name(void) const {
+std::string OutputChunker::gen_chunk_name(size_t chunk_count) const {
     auto base = std::string{m_basename};
-    base.append("." + std::to_string(m_chunk_count) + ".gz");
+    base.append("." + std::to_string(chunk_count) + ".gz");
     return base;
 }
 
 OutputChunker::OutputChunker(const std::string& basename,
-                             bool compress)
-    : m_basename(basename), m_compress(compress) {
+                             bool compress, TrainingFormat format,
+                             int compression_level)
+    : m_basename(basename), m_compress(compress), m_format(format),
+      m_compression_level(compression_level) {
+    assert(m_compression_level >= 1 && m_compression_level <= 9);
+    m_writer = std::thread(&OutputChunker::writer_loop, this);
 }
 
 OutputChunker::~OutputChunker() {
-    flush_chunks();
+    try {
+        // Always leave a file behind, but no empty trailing chunk
+        if (m_step_count > 0 || m_chunk_count == 0) {
+            flush_chunks();
+        }
+    } catch (const std::exception& e) {
+        Utils::myprintf("Error writing training data: %s\n", e.what());
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_cv.notify_all();
+    m_writer.join();
+    if (m_error) {
+        try {
+            std::rethrow_exception(m_error);
+        } catch (const std::exception& e) {
+            Utils::myprintf("Error writing training data: %s\n", e.what());
+        }
+    }
 }
 
 void OutputChunker::append(const std::string& str) {
@@ -59,44 +92,131 @@ void OutputChunker::append(const std::string& str) {
 }
 
 void OutputChunker::flush_chunks() {
-    if (m_compress) {
-        auto chunk_name = gen_chunk_name();
-        auto out = gzopen(chunk_name.c_str(), "wb9");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // Only one chunk can be waiting for the writer
+    m_cv.wait(lock, [this]() { return !m_has_pending; });
+    if (m_error) {
+        auto error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
 
-        auto in_buff_size = m_buffer.size();
-        auto in_buff = std::make_unique<char[]>(in_buff_size);
-        memcpy(in_buff.get(), m_buffer.data(), in_buff_size);
+    // Swapping hands the writer the data without a copy, and gives the
+    // next chunk the memory the previous one used.
+    std::swap(m_pending, m_buffer);
+    m_pending_chunk = m_chunk_count;
+    m_pending_steps = m_step_count;
+    m_has_pending = true;
+    lock.unlock();
+    m_cv.notify_all();
 
-        auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
-        if (!comp_size) {
-            throw std::runtime_error("Error in gzip output");
+    m_chunk_count++;
+    m_step_count = 0;
+}
+
+void OutputChunker::writer_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait(lock, [this]() { return m_has_pending || m_exit; });
+        if (!m_has_pending) {
+            return;
+        }
+        // flush_chunks leaves m_pending alone until we are done
+        lock.unlock();
+        auto error = std::exception_ptr{};
+        try {
+            write_chunk();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error) {
+            m_error = error;
+        }
+        m_pending.clear();
+        m_has_pending = false;
+        m_cv.notify_all();
+    }
+}
+
+void OutputChunker::write_chunk() {
+    auto chunk_name = m_basename;
+    if (m_compress) {
+        chunk_name = gen_chunk_name(m_pending_chunk);
+        auto mode = "wb" + std::to_string(m_compression_level);
+        auto out = gzopen(chunk_name.c_str(), mode.c_str());
+        if (!out) {
+            throw std::runtime_error("Could not open " + chunk_name);
+        }
+
+        auto ok = true;
+        if (m_format == TrainingFormat::BINARY) {
+            auto header = ChunkFormat::binary_header();
+            ok = gzwrite(out, header.data(), header.size()) > 0;
+        }
+        if (ok && !m_pending.empty()) {
+            ok = gzwrite(out, m_pending.data(), m_pending.size()) > 0;
         }
-        Utils::myprintf("Writing chunk %d\n",  m_chunk_count);
         gzclose(out);
+        if (!ok) {
+            throw std::runtime_error("Error in gzip output");
+        }
+        Utils::myprintf("Writing chunk %d\n", int(m_pending_chunk));
     } else {
-        auto chunk_name = m_basename;
-        auto flags = std::ofstream::out | std::ofstream::app;
+        auto flags = std::ofstream::out | std::ofstream::app
+                     | std::ofstream::binary;
         auto out = std::ofstream{chunk_name, flags};
-        out << m_buffer;
+        // Appending, so only a new file gets a header
+        out.seekp(0, std::ios::end);
+        if (m_format == TrainingFormat::BINARY && out.tellp() == 0) {
+            out << ChunkFormat::binary_header();
+        }
+        out << m_pending;
         out.close();
     }
 
-    m_buffer.clear();
-    m_chunk_count++;
-    m_step_count = 0;
+    if (m_format == TrainingFormat::BINARY) {
+        auto index = std::ofstream{m_basename + ".index",
+                                   std::ofstream::out | std::ofstream::app};
+        index << chunk_name << " " << m_pending_steps << std::endl;
+    }
 }
 
 void Training::clear_training() {
     Training::m_data.clear();
+    Training::m_boards.clear();
+    Training::m_board_index.clear();
+}
+
+/*
+    Index of the stones of this position in the board store, adding them
+    if the store doesn't have them yet. Positions are told apart by their
+    stone hash, which is what superko detection relies on as well.
+*/
+uint32 Training::store_board(const KoState& state) {
+    auto it = m_board_index.find(state.board.ko_hash);
+    if (it != end(m_board_index)) {
+        return it->second;
+    }
+    auto stones = StoneBoard{};
+    for (auto j = 0; j < 19; j++) {
+        for (auto i = 0; i < 19; i++) {
+            auto vtx = state.board.get_vertex(i, j);
+            auto color = state.board.get_square(vtx);
+            if (color != FastBoard::EMPTY) {
+                stones[color][j * 19 + i] = true;
+            }
+        }
+    }
+    auto index = uint32(m_boards.size());
+    m_boards.emplace_back(stones);
+    m_board_index.emplace(state.board.ko_hash, index);
+    return index;
 }
 
 void Training::record(GameState& state, const UCTNode& root) {
-    auto step = TimeStep{};
+    auto step = PackedStep{};
     step.to_move = state.board.get_to_move();
-    step.planes = Network::NNPlanes{};
-    Network::gather_features(&state, step.planes);
-
-    step.probabilities.resize((19 * 19) + 1);
 
     // Get total visit amount. We count rather
     // than trust the root to avoid ttable issues.
@@ -117,71 +237,166 @@ void Training::record(GameState& state, const UCTNode& root) {
 
     child = root.get_first_child();
     while (child != nullptr) {
-        auto prob = child->get_visits() / sum_visits;
+        auto visits = child->get_visits();
         auto move = child->get_move();
-        if (move != FastBoard::PASS) {
-            auto xy = state.board.get_xy(move);
-            step.probabilities[xy.second * 19 + xy.first] = prob;
-        } else {
-            step.probabilities[19 * 19] = prob;
+        if (visits > 0) {
+            auto idx = 19 * 19;
+            if (move != FastBoard::PASS) {
+                auto xy = state.board.get_xy(move);
+                idx = xy.second * 19 + xy.first;
+            }
+            step.visits.emplace_back(uint16(idx), visits);
         }
         child = child->get_sibling();
     }
 
-    m_data.emplace_back(step);
+    // The same positions as gather_features walks through
+    step.history.fill(PackedStep::NO_BOARD);
+    step.history[0] = store_board(state);
+    for (auto h = size_t{1}; h < step.history.size(); h++) {
+        auto past = state.get_past_state(int(h));
+        if (past == nullptr) {
+            break;
+        }
+        step.history[h] = store_board(*past);
+    }
+
+    m_data.emplace_back(std::move(step));
+}
+
+/*
+    The full input planes and search probabilities of a recorded
+    position, as gather_features and the old dense record would have
+    given them.
+*/
+TimeStep Training::expand(const PackedStep& packed) {
+    auto step = TimeStep{};
+    step.to_move = packed.to_move;
+    step.planes = Network::NNPlanes(18);
+    auto us = packed.to_move;
+    auto them = (us == FastBoard::BLACK ? FastBoard::WHITE : FastBoard::BLACK);
+    for (auto h = size_t{0}; h < packed.history.size(); h++) {
+        if (packed.history[h] == PackedStep::NO_BOARD) {
+            break;
+        }
+        const auto& stones = m_boards[packed.history[h]];
+        step.planes[h] = stones[us];
+        step.planes[8 + h] = stones[them];
+    }
+    if (us == FastBoard::WHITE) {
+        step.planes[17].set();
+    } else {
+        step.planes[16].set();
+    }
+
+    auto sum_visits = 0.0;
+    for (const auto& move : packed.visits) {
+        sum_visits += move.second;
+    }
+    step.probabilities.resize((19 * 19) + 1);
+    for (const auto& move : packed.visits) {
+        step.probabilities[move.first] = move.second / sum_visits;
+    }
+    return step;
 }
 
-void Training::dump_training(int winner_color, const std::string& filename) {
-    auto chunker = OutputChunker{filename, true};
+void Training::dump_training(int winner_color, const std::string& filename,
+                             TrainingFormat format, int compression_level) {
+    OutputChunker chunker{filename, true, format, compression_level};
     dump_training(winner_color, chunker);
 }
 
 void Training::dump_training(int winner_color, OutputChunker& outchunk) {
-    for (const auto& step : m_data) {
-        auto out = std::stringstream{};
-        // First output 16 times an input feature plane
-        for (auto p = size_t{0}; p < 16; p++) {
-            const auto& plane = step.planes[p];
-            // Write it out as a string of hex characters
-            for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
-                auto hexbyte =  plane[bit]     << 3
-                              | plane[bit + 1] << 2
-                              | plane[bit + 2] << 1
-                              | plane[bit + 3] << 0;
-                out << std::hex << hexbyte;
-            }
-            // 361 % 4 = 1 so the last bit goes by itself
-            assert(plane.size() % 4 == 1);
-            out << plane[plane.size() - 1];
-            out << std::dec << std::endl;
-        }
-        // The side to move planes can be compactly encoded into a single
-        // bit, 0 = black to move.
-        out << (step.to_move == FastBoard::BLACK ? "0" : "1") << std::endl;
-        // Then a 362 long array of float probabilities
-        for (auto it = begin(step.probabilities);
-            it != end(step.probabilities); ++it) {
-            out << *it;
-            if (boost::next(it) != end(step.probabilities)) {
-                out << " ";
+    for (const auto& packed : m_data) {
+        auto step = expand(packed);
+        auto to_move_won = (step.to_move == winner_color);
+        outchunk.append(encode(step, to_move_won, outchunk.get_format()));
+    }
+}
+
+/*
+    The record of a position, planes 16 and 17 become the side to move.
+*/
+ChunkFormat::Record Training::to_record(const TimeStep& step,
+                                        bool to_move_won) {
+    auto record = ChunkFormat::Record{};
+    record.planes.fill(0);
+    for (auto p = size_t{0}; p < ChunkFormat::HISTORY_PLANES; p++) {
+        const auto& plane = step.planes[p];
+        auto bits = &record.planes[p * ChunkFormat::PLANE_BYTES];
+        for (auto point = size_t{0}; point < plane.size(); point++) {
+            if (plane[point]) {
+                bits[point / 8] |= uint8(1 << (point % 8));
             }
         }
-        out << std::endl;
-        // And the game result for the side to move
-        if (step.to_move == winner_color) {
-            out << "1";
-        } else {
-            out << "-1";
+    }
+    record.to_move = (step.to_move == FastBoard::BLACK ? 0 : 1);
+    record.winner = (to_move_won ? 1 : -1);
+    assert(step.probabilities.size() == record.probabilities.size());
+    std::copy(begin(step.probabilities), end(step.probabilities),
+              begin(record.probabilities));
+    return record;
+}
+
+void Training::from_record(const ChunkFormat::Record& record,
+                           TimeStep& step, bool& to_move_won) {
+    step.planes = Network::NNPlanes(18);
+    for (auto p = size_t{0}; p < ChunkFormat::HISTORY_PLANES; p++) {
+        auto& plane = step.planes[p];
+        auto bits = &record.planes[p * ChunkFormat::PLANE_BYTES];
+        for (auto point = size_t{0}; point < plane.size(); point++) {
+            plane[point] = (bits[point / 8] >> (point % 8)) & 1;
         }
-        out << std::endl;
-        outchunk.append(out.str());
     }
+    if (record.to_move == 0) {
+        step.to_move = FastBoard::BLACK;
+        step.planes[16].set();
+    } else {
+        step.to_move = FastBoard::WHITE;
+        step.planes[17].set();
+    }
+    step.probabilities.assign(begin(record.probabilities),
+                              end(record.probabilities));
+    to_move_won = (record.winner == 1);
 }
 
-void Training::process_game(GameState& state, size_t& train_pos, int who_won,
+std::string Training::encode(const TimeStep& step, bool to_move_won,
+                             TrainingFormat format) {
+    auto record = to_record(step, to_move_won);
+    if (format == TrainingFormat::BINARY) {
+        return ChunkFormat::encode_binary(record);
+    }
+    return ChunkFormat::encode_text(record);
+}
+
+size_t Training::convert_to_binary(const std::string& in_filename,
+                                   const std::string& out_filename,
+                                   int compression_level) {
+    auto records = std::vector<ChunkFormat::Record>{};
+    auto skipped = size_t{0};
+    auto converted = ChunkFormat::decode_chunk(
+        ChunkFormat::read_chunk(in_filename), records, &skipped);
+
+    OutputChunker outchunker{out_filename, true, TrainingFormat::BINARY,
+                             compression_level};
+    for (const auto& record : records) {
+        outchunker.append(ChunkFormat::encode_binary(record));
+    }
+    if (skipped) {
+        std::cout << "Skipped " << skipped << " malformed positions."
+                  << std::endl;
+    }
+    return converted;
+}
+
+/*
+    Pick positions from a game, every one with a 1/SKIP_SIZE chance,
+    or all of them. Returns false if the game can't be replayed.
+*/
+bool Training::process_game(GameState& state,
                             const std::vector<int>& tree_moves,
-                            OutputChunker& outchunker) {
-    clear_training();
+                            std::vector<TimeStep>& steps,
+                            bool every_position) {
     auto counter = size_t{0};
     state.rewind();
 
@@ -191,30 +406,27 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
         auto this_move = -1;
 
         // Detect if this SGF seems to be corrupted
-        auto moves = state.generate_moves(to_move);
-        auto moveseen = false;
-        for(const auto& gen_move : moves) {
-            if (gen_move == move) {
-                if (move != FastBoard::PASS) {
-                    // get x y coords for actual move
-                    auto xy = state.board.get_xy(move);
-                    this_move = (xy.second * 19) + xy.first;
-                } else {
-                    this_move = (19 * 19); // PASS
-                }
-                moveseen = true;
-                break;
+        auto moveseen = (move == FastBoard::PASS);
+        if (move >= 0 && move < FastBoard::MAXSQ) {
+            moveseen = state.generate_moves(to_move)[move];
+        }
+        if (moveseen) {
+            if (move != FastBoard::PASS) {
+                // get x y coords for actual move
+                auto xy = state.board.get_xy(move);
+                this_move = (xy.second * 19) + xy.first;
+            } else {
+                this_move = (19 * 19); // PASS
             }
         }
 
         if (!moveseen) {
             std::cout << "Mainline move not found: " << move << std::endl;
-            return;
+            return false;
         }
 
         // Pick every 1/SKIP_SIZE th position.
-        auto skip = Random::get_Rng()->randfix<SKIP_SIZE>();
-        if (skip == 0) {
+        if (every_position || Random::get_Rng()->randfix<SKIP_SIZE>() == 0) {
             auto step = TimeStep{};
             step.to_move = state.board.get_to_move();
             step.planes = Network::NNPlanes{};
@@ -223,68 +435,378 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
             step.probabilities.resize((19 * 19) + 1);
             step.probabilities[this_move] = 1.0f;
 
-            train_pos++;
-            m_data.emplace_back(step);
+            steps.emplace_back(step);
         }
 
         counter++;
     } while (state.forward_move() && counter < tree_moves.size());
 
-    dump_training(who_won, outchunker);
+    return true;
+}
+
+/*
+    The positions of one game and its winner. Returns false if the game
+    is unusable.
+*/
+bool Training::game_steps(boost::string_ref sgf, bool every_position,
+                          std::vector<TimeStep>& steps, int& who_won) {
+    auto sgftree = std::make_unique<SGFTree>();
+    try {
+        sgftree->load_from_string(sgf);
+    } catch (...) {
+        return false;
+    };
+
+    auto tree_moves = sgftree->get_mainline();
+    // Empty game or couldn't be parsed?
+    if (tree_moves.size() == 0) {
+        return false;
+    }
+
+    who_won = sgftree->get_winner();
+    // Accept all komis and handicaps, but reject no usable result
+    if (who_won != FastBoard::BLACK && who_won != FastBoard::WHITE) {
+        return false;
+    }
+
+    auto state =
+        std::make_unique<GameState>(sgftree->follow_mainline_state());
+    // Our board size is hardcoded in several places
+    if (state->board.get_boardsize() != 19) {
+        return false;
+    }
+
+    return process_game(*state, tree_moves, steps, every_position);
+}
+
+/*
+    The encoded training records for one game, none if it is unusable.
+    Runs on the thread pool, so it only touches its own data.
+*/
+std::vector<std::string> Training::process_sgf(boost::string_ref sgf,
+                                               TrainingFormat format) {
+    auto records = std::vector<std::string>{};
+    auto steps = std::vector<TimeStep>{};
+    auto who_won = int{FastBoard::EMPTY};
+    if (!game_steps(sgf, false, steps, who_won)) {
+        return records;
+    }
+    for (const auto& step : steps) {
+        auto to_move_won = (step.to_move == who_won);
+        records.emplace_back(encode(step, to_move_won, format));
+    }
+    return records;
 }
 
 void Training::dump_supervised(const std::string& sgf_name,
-                               const std::string& out_filename) {
-    auto outchunker = OutputChunker{out_filename, true};
-    auto games = SGFParser::chop_all(sgf_name);
-    auto gametotal = games.size();
+                               const std::string& out_filename,
+                               TrainingFormat format,
+                               int compression_level) {
+    OutputChunker outchunker{out_filename, true, format, compression_level};
+    // The games stay in the mapped file, only their order is shuffled
+    SGFFile sgf_file{sgf_name};
+    auto gametotal = sgf_file.size();
     auto train_pos = size_t{0};
 
     std::cout << "Total games in file: " << gametotal << std::endl;
     // Shuffle games around
     std::cout << "Shuffling...";
+    auto games = std::vector<size_t>(gametotal);
+    std::iota(begin(games), end(games), size_t{0});
     std::shuffle(begin(games), end(games), *Random::get_Rng());
     std::cout << "done." << std::endl;
 
     // Loop over the database multiple times. We will select different
     // positions from each game on every pass.
     for (auto repeat = size_t{0}; repeat < SKIP_SIZE; repeat++) {
-        for (auto gamecount = size_t{0}; gamecount < gametotal; gamecount++) {
-            auto sgftree = std::make_unique<SGFTree>();
-            try {
-                sgftree->load_from_string(games[gamecount]);
-            } catch (...) {
-                continue;
-            };
-
-            if (gamecount % (1000) == 0) {
-                std::cout << "Game " << gamecount
-                          << ", " << train_pos << " positions" << std::endl;
+        // Games are processed in parallel, but their records go out in
+        // the shuffled order, so a chunk still holds positions from
+        // many different games.
+        for (auto batch_start = size_t{0}; batch_start < gametotal;
+             batch_start += SUPERVISED_BATCH) {
+            auto batch_end = std::min(gametotal,
+                                      batch_start + SUPERVISED_BATCH);
+            auto records =
+                std::vector<std::vector<std::string>>(batch_end - batch_start);
+            Utils::ThreadGroup tg(thread_pool);
+            for (auto gamecount = batch_start; gamecount < batch_end;
+                 gamecount++) {
+                tg.add_task([&records, &games, &sgf_file, batch_start,
+                             gamecount, format]() {
+                    records[gamecount - batch_start] =
+                        process_sgf(sgf_file.get_game(games[gamecount]),
+                                    format);
+                });
             }
+            tg.wait_all();
 
-            auto tree_moves = sgftree->get_mainline();
-            // Empty game or couldn't be parsed?
-            if (tree_moves.size() == 0) {
-                continue;
+            for (const auto& game_records : records) {
+                for (const auto& record : game_records) {
+                    outchunker.append(record);
+                    train_pos++;
+                }
+            }
+
+            std::cout << "Game " << batch_end
+                      << ", " << train_pos << " positions" << std::endl;
+        }
+    }
+
+    std::cout << "Dumped " << train_pos << " training positions." << std::endl;
+}
+
+/*
+    Entries are collected in memory up to a fixed number, then sorted
+    and written to a file of their own. Reading them back merges all
+    these runs, so a data set of any size is sorted with bounded memory.
+*/
+template <typename T>
+class SortedRuns {
+public:
+    SortedRuns(const std::string& basename, size_t run_size)
+        : m_basename(basename), m_run_size(run_size) {
+        m_buffer.reserve(m_run_size);
+    }
+    ~SortedRuns() {
+        m_streams.clear();
+        for (const auto& file : m_files) {
+            std::remove(file.c_str());
+        }
+    }
+
+    void add(const T& entry) {
+        m_buffer.emplace_back(entry);
+        if (m_buffer.size() >= m_run_size) {
+            write_run();
+        }
+    }
+
+    // Stop adding, and start reading the entries back in sorted order.
+    void finish() {
+        if (m_files.empty()) {
+            // Everything fit in memory
+            std::sort(begin(m_buffer), end(m_buffer));
+            m_reads.emplace_back(std::move(m_buffer));
+            m_read_pos.emplace_back(0);
+            m_streams.emplace_back();
+            if (!m_reads[0].empty()) {
+                m_heap.emplace(m_reads[0][0], 0);
+            }
+            return;
+        }
+        if (!m_buffer.empty()) {
+            write_run();
+        }
+        m_buffer = std::vector<T>{};
+        for (auto run = size_t{0}; run < m_files.size(); run++) {
+            m_streams.emplace_back(m_files[run], std::ios::binary);
+            m_reads.emplace_back();
+            m_read_pos.emplace_back(0);
+            if (refill(run)) {
+                m_heap.emplace(m_reads[run][0], run);
             }
+        }
+    }
+
+    bool next(T& entry) {
+        if (m_heap.empty()) {
+            return false;
+        }
+        auto run = m_heap.top().second;
+        entry = m_heap.top().first;
+        m_heap.pop();
+        if (++m_read_pos[run] < m_reads[run].size() || refill(run)) {
+            m_heap.emplace(m_reads[run][m_read_pos[run]], run);
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t READ_SIZE = 4096;
+
+    void write_run() {
+        std::sort(begin(m_buffer), end(m_buffer));
+        auto filename = m_basename + "." + std::to_string(m_files.size());
+        auto out = std::ofstream{filename, std::ios::binary};
+        out.write(reinterpret_cast<const char*>(m_buffer.data()),
+                  m_buffer.size() * sizeof(T));
+        if (!out) {
+            throw std::runtime_error("Error writing " + filename);
+        }
+        m_files.emplace_back(filename);
+        m_buffer.clear();
+    }
+
+    bool refill(size_t run) {
+        auto& stream = m_streams[run];
+        auto& entries = m_reads[run];
+        if (!stream.is_open()) {
+            return false;
+        }
+        entries.resize(READ_SIZE);
+        stream.read(reinterpret_cast<char*>(entries.data()),
+                    READ_SIZE * sizeof(T));
+        entries.resize(stream.gcount() / sizeof(T));
+        m_read_pos[run] = 0;
+        return !entries.empty();
+    }
 
-            auto who_won = sgftree->get_winner();
-            // Accept all komis and handicaps, but reject no usable result
-            if (who_won != FastBoard::BLACK && who_won != FastBoard::WHITE) {
-                continue;
+    std::string m_basename;
+    size_t m_run_size;
+    std::vector<T> m_buffer;
+    std::vector<std::string> m_files;
+
+    std::vector<std::ifstream> m_streams;
+    std::vector<std::vector<T>> m_reads;
+    std::vector<size_t> m_read_pos;
+    using HeapEntry = std::pair<T, size_t>;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                        std::greater<HeapEntry>> m_heap;
+};
+
+/*
+    Hash of a position and its history: the hashes of the 8 history
+    boards and the side to move, all under the same symmetry, the one
+    that gives the lowest result. The board is scratch space, it is
+    left empty.
+*/
+uint64 Training::position_hash(const TimeStep& step, FullBoard& board) {
+    auto us = FastBoard::square_t(step.to_move);
+    auto them = (us == FastBoard::BLACK ? FastBoard::WHITE
+                                        : FastBoard::BLACK);
+    board.set_to_move(step.to_move);
+    auto hashes = std::array<uint64, 8>{};
+    for (auto h = size_t{0}; h < 8; h++) {
+        const auto& ours = step.planes[h];
+        const auto& theirs = step.planes[8 + h];
+        for (auto idx = size_t{0}; idx < ours.size(); idx++) {
+            if (ours[idx]) {
+                board.set_square(idx % 19, idx / 19, us);
+            } else if (theirs[idx]) {
+                board.set_square(idx % 19, idx / 19, them);
             }
+        }
+        board.calc_sym_hashes();
+        auto board_hashes = board.get_rotated_hashes();
+        for (auto sym = size_t{0}; sym < hashes.size(); sym++) {
+            hashes[sym] = hashes[sym] * 0x9E3779B97F4A7C15ULL
+                          ^ board_hashes[sym];
+        }
+        for (auto idx = size_t{0}; idx < ours.size(); idx++) {
+            if (ours[idx] || theirs[idx]) {
+                board.set_square(idx % 19, idx / 19, FastBoard::EMPTY);
+            }
+        }
+    }
+    return *std::min_element(begin(hashes), end(hashes));
+}
 
-            auto state =
-                std::make_unique<GameState>(sgftree->follow_mainline_state());
-            // Our board size is hardcoded in several places
-            if (state->board.get_boardsize() != 19) {
-                continue;
+/*
+    Go over all positions in the given training chunks and SGF files
+    (named *.sgf), always in the same order. All positions of a game in
+    an SGF file are used.
+*/
+void Training::for_each_position(
+    const std::vector<std::string>& inputs,
+    const std::function<void(const TimeStep&, bool)>& visit) {
+    auto step = TimeStep{};
+    auto to_move_won = false;
+    for (const auto& input : inputs) {
+        if (boost::algorithm::iends_with(input, ".sgf")) {
+            SGFFile sgf_file{input};
+            auto gametotal = sgf_file.size();
+            for (auto batch_start = size_t{0}; batch_start < gametotal;
+                 batch_start += SUPERVISED_BATCH) {
+                auto batch_end = std::min(gametotal,
+                                          batch_start + SUPERVISED_BATCH);
+                auto games =
+                    std::vector<std::vector<TimeStep>>(batch_end - batch_start);
+                auto winners = std::vector<int>(batch_end - batch_start);
+                Utils::ThreadGroup tg(thread_pool);
+                for (auto game = batch_start; game < batch_end; game++) {
+                    tg.add_task([&games, &winners, &sgf_file,
+                                 batch_start, game]() {
+                        auto& steps = games[game - batch_start];
+                        if (!game_steps(sgf_file.get_game(game), true, steps,
+                                        winners[game - batch_start])) {
+                            steps.clear();
+                        }
+                    });
+                }
+                tg.wait_all();
+                for (auto game = size_t{0}; game < games.size(); game++) {
+                    for (const auto& game_step : games[game]) {
+                        visit(game_step, game_step.to_move == winners[game]);
+                    }
+                }
             }
+            continue;
+        }
 
-            process_game(*state, train_pos, who_won, tree_moves,
-                        outchunker);
+        auto records = std::vector<ChunkFormat::Record>{};
+        ChunkFormat::decode_chunk(ChunkFormat::read_chunk(input), records);
+        for (const auto& record : records) {
+            from_record(record, step, to_move_won);
+            visit(step, to_move_won);
         }
     }
+}
 
-    std::cout << "Dumped " << train_pos << " training positions." << std::endl;
+size_t Training::dedup_training(const std::vector<std::string>& inputs,
+                                const std::string& out_filename,
+                                size_t max_copies, TrainingFormat format,
+                                int compression_level) {
+    // First pass: the hash of every position, with its place in the
+    // input, sorted on disk.
+    SortedRuns<std::pair<uint64, uint64>> hashes{
+        out_filename + ".hashes", DEDUP_RUN_SIZE};
+    auto board = std::make_unique<FullBoard>();
+    board->reset_board(19);
+    auto total = uint64{0};
+    for_each_position(inputs, [&](const TimeStep& step, bool) {
+        hashes.add({position_hash(step, *board), total++});
+    });
+    std::cout << "Hashed " << total << " positions." << std::endl;
+
+    // Equal hashes are now next to each other, in input order. All
+    // copies of a position past the first max_copies are dropped.
+    SortedRuns<uint64> dropped{out_filename + ".dropped", DEDUP_RUN_SIZE};
+    hashes.finish();
+    auto entry = std::pair<uint64, uint64>{};
+    auto distinct = size_t{0};
+    auto copies = size_t{0};
+    auto previous = uint64{0};
+    while (hashes.next(entry)) {
+        if (distinct == 0 || entry.first != previous) {
+            distinct++;
+            copies = 0;
+            previous = entry.first;
+        }
+        if (++copies > max_copies) {
+            dropped.add(entry.second);
+        }
+    }
+    std::cout << "Found " << distinct << " distinct positions." << std::endl;
+
+    // Second pass: write out everything that isn't dropped.
+    dropped.finish();
+    OutputChunker outchunker{out_filename, true, format, compression_level};
+    auto next_drop = uint64{0};
+    auto have_drop = dropped.next(next_drop);
+    auto position = uint64{0};
+    auto written = size_t{0};
+    for_each_position(inputs, [&](const TimeStep& step, bool to_move_won) {
+        if (have_drop && position == next_drop) {
+            have_drop = dropped.next(next_drop);
+        } else {
+            outchunker.append(encode(step, to_move_won, format));
+            written++;
+        }
+        position++;
+    });
+    if (position != total) {
+        throw std::runtime_error("Input changed while deduplicating");
+    }
+    std::cout << "Wrote " << written << " training positions." << std::endl;
+    return written;
 }
@@ -20,11 +20,22 @@
 #define TRAINING_H_INCLUDED
 
 #include "config.h"
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <boost/utility/string_ref.hpp>
+#include "ChunkFormat.h"
 #include "GameState.h"
 #include "Network.h"
 
+class UCTNode;
+
 class TimeStep {
 public:
     Network::NNPlanes planes;
@@ -32,44 +43,147 @@ public:
     int to_move;
 };
 
+/*
+    A position as it is kept by record() until the game is dumped.
+    Instead of its own input planes it refers to the boards of the last
+    8 positions, which are stored once and shared by the positions that
+    follow. Only the moves the search visited are listed. expand() turns
+    it back into a TimeStep when the data is written out.
+*/
+class PackedStep {
+public:
+    static constexpr uint32 NO_BOARD = ~uint32{0};
+    // Board store indices, the current position first
+    std::array<uint32, 8> history;
+    // Point (y * 19 + x, pass is 19 * 19) and visit count
+    std::vector<std::pair<uint16, int>> visits;
+    int to_move;
+};
+
+/*
+    The chunk formats, see ChunkFormat.h. With BINARY the chunker also
+    writes an index next to the chunks, one line per chunk with its
+    file name and record count.
+*/
+enum class TrainingFormat {
+    TEXT, BINARY
+};
+
+/*
+    Chunks are compressed and written by a thread of their own while the
+    next chunk is being filled, so the producer only waits when it fills
+    a chunk faster than the previous one can be written.
+*/
 class OutputChunker {
 public:
-    OutputChunker(const std::string& basename, bool compress = false);
+    OutputChunker(const std::string& basename, bool compress = false,
+                  TrainingFormat format = TrainingFormat::TEXT,
+                  int compression_level = DEFAULT_COMPRESSION_LEVEL);
     ~OutputChunker();
     void append(const std::string& str);
+    TrainingFormat get_format() const {
+        return m_format;
+    }
 
     // Group this many positions in a batch.
     static constexpr size_t CHUNK_SIZE = 16384;
+    // zlib level, 1 (fastest) to 9 (smallest)
+    static constexpr int DEFAULT_COMPRESSION_LEVEL = 9;
 private:
-    std::string gen_chunk_name() const;
+    std::string gen_chunk_name(size_t chunk_count) const;
     void flush_chunks();
+    void write_chunk();
+    void writer_loop();
     size_t m_step_count{0};
     size_t m_chunk_count{0};
     std::string m_buffer;
     std::string m_basename;
     bool m_compress{false};
+    TrainingFormat m_format{TrainingFormat::TEXT};
+    int m_compression_level{DEFAULT_COMPRESSION_LEVEL};
+
+    // The chunk handed to the writer thread, guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::string m_pending;
+    size_t m_pending_chunk{0};
+    size_t m_pending_steps{0};
+    bool m_has_pending{false};
+    bool m_exit{false};
+    std::exception_ptr m_error;
+    std::thread m_writer;
 };
 
 class Training {
 public:
     static void clear_training();
     static void dump_training(int winner_color,
-                              const std::string& out_filename);
+                              const std::string& out_filename,
+                              TrainingFormat format = TrainingFormat::TEXT,
+                              int compression_level =
+                                  OutputChunker::DEFAULT_COMPRESSION_LEVEL);
+    // The caller serializes access to the chunker.
+    static void dump_training(int winner_color,
+                              OutputChunker& outchunker);
     static void record(GameState& state, const UCTNode& node);
 
     static void dump_supervised(const std::string& sgf_file,
-                                const std::string& out_filename);
+                                const std::string& out_filename,
+                                TrainingFormat format = TrainingFormat::TEXT,
+                                int compression_level =
+                                    OutputChunker::DEFAULT_COMPRESSION_LEVEL);
+    // Rewrite a text chunk as binary chunks.
+    static size_t convert_to_binary(const std::string& in_filename,
+                                    const std::string& out_filename,
+                                    int compression_level =
+                                        OutputChunker::DEFAULT_COMPRESSION_LEVEL);
+    // Copy the positions in training chunks and SGF files, keeping at
+    // most max_copies of every position. Returns the number kept.
+    static size_t dedup_training(const std::vector<std::string>& inputs,
+                                 const std::string& out_filename,
+                                 size_t max_copies,
+                                 TrainingFormat format = TrainingFormat::TEXT,
+                                 int compression_level =
+                                     OutputChunker::DEFAULT_COMPRESSION_LEVEL);
 private:
     // Consider only every 1/th position in a game.
     // This ensures that positions in a chunk are from disjoint games.
     static constexpr size_t SKIP_SIZE = 16;
 
-    static void process_game(GameState& state, size_t& train_pos, int who_won,
+    // Games handed to the thread pool at once by dump_supervised
+    static constexpr size_t SUPERVISED_BATCH = 1024;
+
+    // Position hashes dedup_training sorts in memory at once, 64 MiB
+    static constexpr size_t DEDUP_RUN_SIZE = size_t{1} << 22;
+
+    static std::vector<std::string> process_sgf(boost::string_ref sgf,
+                                                TrainingFormat format);
+    static bool game_steps(boost::string_ref sgf, bool every_position,
+                           std::vector<TimeStep>& steps, int& who_won);
+    static bool process_game(GameState& state,
                              const std::vector<int>& tree_moves,
-                             OutputChunker& outchunker);
-    static void dump_training(int winner_color,
-                              OutputChunker& outchunker);
-    static std::vector<TimeStep> m_data;
+                             std::vector<TimeStep>& steps,
+                             bool every_position = false);
+    static ChunkFormat::Record to_record(const TimeStep& step,
+                                         bool to_move_won);
+    static void from_record(const ChunkFormat::Record& record,
+                            TimeStep& step, bool& to_move_won);
+    static std::string encode(const TimeStep& step, bool to_move_won,
+                              TrainingFormat format);
+    static uint64 position_hash(const TimeStep& step, FullBoard& board);
+    static void for_each_position(
+        const std::vector<std::string>& inputs,
+        const std::function<void(const TimeStep&, bool)>& visit);
+    static uint32 store_board(const KoState& state);
+    static TimeStep expand(const PackedStep& packed);
+    // Every thread records the game it plays, see --selfplay.
+    static thread_local std::vector<PackedStep> m_data;
+
+    // Black and white stones of each distinct position in m_data,
+    // found by the stone hash of the position.
+    using StoneBoard = std::array<Network::BoardPlane, 2>;
+    static thread_local std::vector<StoneBoard> m_boards;
+    static thread_local std::unordered_map<uint64, uint32> m_board_index;
 };
 
 #endif
@@ -97,8 +97,12 @@ bool UCTNode::create_children(std::atomic<int> & nodecount,
     m_is_expanding = true;
     lock.unlock();
 
-    auto raw_netlist = Network::get_scored_moves(
-        &state, Network::Ensemble::RANDOM_ROTATION);
+    Network::Netresult raw_netlist;
+    {
+        SearchStats::Timer timer(SearchStats::NN_EVAL);
+        raw_netlist = Network::get_scored_moves(
+            &state, Network::Ensemble::RANDOM_ROTATION);
+    }
 
     // DCNN returns winrate as side to move
     auto net_eval = raw_netlist.second;
@@ -109,20 +113,9 @@ bool UCTNode::create_children(std::atomic<int> & nodecount,
     }
     eval = net_eval;
 
-    FastBoard & board = state.board;
-    std::vector<Network::scored_node> nodelist;
-
-    for (auto& node : raw_netlist.first) {
-        auto vertex = node.second;
-        if (vertex != FastBoard::PASS) {
-            if (vertex != state.m_komove
-                && !board.is_suicide(vertex, board.get_to_move())) {
-                nodelist.emplace_back(node);
-            }
-        } else {
-            nodelist.emplace_back(node);
-        }
-    }
+    // The network only returns legal moves
+    auto & nodelist = raw_netlist.first;
+    SearchStats::Timer timer(SearchStats::EXPAND);
     link_nodelist(nodecount, nodelist);
 
     return true;
@@ -21,11 +21,13 @@
 #include <assert.h>
 #include <limits.h>
 #include <cmath>
+#include <string>
 #include <vector>
 #include <utility>
 #include <thread>
 #include <algorithm>
 #include <type_traits>
+#include <boost/format.hpp>
 
 #include "FastBoard.h"
 #include "UCTSearch.h"
@@ -42,8 +44,79 @@
 
 using namespace Utils;
 
-UCTSearch::UCTSearch(GameState & g)
-    : m_rootstate(g) {
+thread_local std::vector<SearchStats> UCTSearch::s_last_stats;
+
+SearchStats& SearchStats::get_thread_stats() {
+    thread_local SearchStats s_stats;
+    return s_stats;
+}
+
+void SearchStats::start() {
+    *this = SearchStats{};
+    m_start = clock::now();
+}
+
+void SearchStats::stop() {
+    m_wall = clock::now() - m_start;
+}
+
+void SearchStats::add(phase_t phase, clock::duration elapsed) {
+    m_time[phase] += elapsed;
+    m_calls[phase]++;
+}
+
+void SearchStats::add_playout() {
+    m_playouts++;
+}
+
+std::string SearchStats::report(const std::vector<SearchStats>& threads) {
+    static const std::array<const char *, NUM_PHASES> names = {
+        "state copy", "TT access", "select", "play move", "superko",
+        "NN eval", "expand", "score", "backup"
+    };
+    using ms = std::chrono::duration<double, std::milli>;
+
+    auto total = SearchStats{};
+    for (const auto& thread : threads) {
+        for (int i = 0; i < NUM_PHASES; i++) {
+            total.m_time[i] += thread.m_time[i];
+            total.m_calls[i] += thread.m_calls[i];
+        }
+        total.m_wall += thread.m_wall;
+        total.m_playouts += thread.m_playouts;
+    }
+    auto wall = std::max(ms(total.m_wall).count(), 0.001);
+
+    auto res = std::string{};
+    res += "phase        calls        ms  us/call  share\n";
+    auto other = ms(total.m_wall);
+    for (int i = 0; i < NUM_PHASES; i++) {
+        auto time = ms(total.m_time[i]);
+        auto calls = total.m_calls[i];
+        other -= time;
+        res += boost::str(boost::format("%-10s %7d %9.1f %8.1f %5.1f%%\n")
+            % names[i] % calls % time.count()
+            % (calls ? 1000.0 * time.count() / calls : 0.0)
+            % (100.0 * time.count() / wall));
+    }
+    res += boost::str(boost::format("%-10s %7s %9.1f %8s %5.1f%%\n")
+        % "other" % "" % other.count() % "" % (100.0 * other.count() / wall));
+    for (size_t i = 0; i < threads.size(); i++) {
+        res += boost::str(boost::format("thread %d: %d playouts in %.1f ms\n")
+            % i % threads[i].m_playouts % ms(threads[i].m_wall).count());
+    }
+    // GTP responses end at the first empty line
+    res.pop_back();
+    return res;
+}
+
+static std::unique_ptr<GameState> copy_state(const GameState & state) {
+    SearchStats::Timer timer(SearchStats::STATE_COPY);
+    return std::make_unique<GameState>(state);
+}
+
+UCTSearch::UCTSearch(GameState & g, TTable & ttable)
+    : m_rootstate(g), m_ttable(ttable) {
     set_playout_limit(cfg_max_playouts);
 }
 
@@ -54,7 +127,10 @@ SearchResult UCTSearch::play_simulation(GameState & currstate, UCTNode* const no
 
     auto result = SearchResult{};
 
-    TTable::get_TT()->sync(hash, komi, node);
+    {
+        SearchStats::Timer timer(SearchStats::TT_ACCESS);
+        m_ttable.sync(hash, komi, node);
+    }
     node->virtual_loss();
 
     if (!node->has_children() && m_nodes < MAX_TREE_SIZE) {
@@ -63,37 +139,59 @@ SearchResult UCTSearch::play_simulation(GameState & currstate, UCTNode* const no
         if (success) {
             result = SearchResult::from_eval(eval);
         } else if (currstate.get_passes() >= 2) {
+            SearchStats::Timer timer(SearchStats::SCORE);
             auto score = currstate.final_score();
             result = SearchResult::from_score(score);
         }
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color);
+        UCTNode * next;
+        {
+            SearchStats::Timer timer(SearchStats::SELECT);
+            next = node->uct_select_child(color);
+        }
 
         if (next != nullptr) {
             auto move = next->get_move();
 
             if (move != FastBoard::PASS) {
-                currstate.play_move(move);
+                bool superko;
+                {
+                    SearchStats::Timer timer(SearchStats::PLAY_MOVE);
+                    currstate.play_move(move);
+                }
+                {
+                    SearchStats::Timer timer(SearchStats::SUPERKO);
+                    superko = currstate.superko();
+                }
 
-                if (!currstate.superko()) {
+                if (!superko) {
                     result = play_simulation(currstate, next);
                 } else {
                     next->invalidate();
                 }
             } else {
-                currstate.play_pass();
+                {
+                    SearchStats::Timer timer(SearchStats::PLAY_MOVE);
+                    currstate.play_pass();
+                }
                 result = play_simulation(currstate, next);
             }
         }
     }
 
-    if (result.valid()) {
-        node->update(result.eval());
+    {
+        SearchStats::Timer timer(SearchStats::BACKUP);
+        if (result.valid()) {
+            node->update(result.eval());
+        }
+        node->virtual_loss_undo();
+    }
+    {
+        SearchStats::Timer timer(SearchStats::TT_ACCESS);
+        m_ttable.update(hash, komi, node);
     }
-    node->virtual_loss_undo();
-    TTable::get_TT()->update(hash, komi, node);
 
     return result;
 }
@@ -312,17 +410,42 @@ bool UCTSearch::playout_limit_reached() const {
 }
 
 void UCTWorker::operator()() {
+    SearchStats::get_thread_stats().start();
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
+        auto currstate = copy_state(m_rootstate);
         auto result = m_search->play_simulation(*currstate, m_root);
         if (result.valid()) {
             m_search->increment_playouts();
         }
     } while(m_search->is_running() && !m_search->playout_limit_reached());
+    m_search->collect_stats();
 }
 
 void UCTSearch::increment_playouts() {
     m_playouts++;
+    SearchStats::get_thread_stats().add_playout();
+}
+
+void UCTSearch::collect_stats() {
+    auto& stats = SearchStats::get_thread_stats();
+    stats.stop();
+    LOCK(m_stats_mutex, lock);
+    m_thread_stats.emplace_back(stats);
+}
+
+std::string UCTSearch::get_last_stats() {
+    if (s_last_stats.empty()) {
+        return "no search yet";
+    }
+    return SearchStats::report(s_last_stats);
+}
+
+int UCTSearch::get_playouts() const {
+    return m_playouts;
+}
+
+int UCTSearch::get_nodes() const {
+    return m_nodes;
 }
 
 int UCTSearch::think(int color, passflag_t passflag) {
@@ -337,6 +460,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     // set up timing info
     Time start;
+    SearchStats::get_thread_stats().start();
 
     m_rootstate.get_timecontrol().set_boardsize(m_rootstate.board.get_boardsize());
     auto time_for_move = m_rootstate.get_timecontrol().max_time_for_move(color);
@@ -365,7 +489,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
     bool keeprunning = true;
     int last_update = 0;
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
+        auto currstate = copy_state(m_rootstate);
 
         auto result = play_simulation(*currstate, &m_root);
         if (result.valid()) {
@@ -388,7 +512,9 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     // stop the search
     m_run = false;
+    collect_stats();
     tg.wait_all();
+    s_last_stats = m_thread_stats;
     m_rootstate.stop_clock(color);
     if (!m_root.has_children()) {
         return FastBoard::PASS;
@@ -408,6 +534,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
                  static_cast<int>(m_nodes),
                  static_cast<int>(m_playouts),
                  (m_playouts * 100) / (centiseconds_elapsed+1));
+        myprintf("%s\n\n", SearchStats::report(s_last_stats).c_str());
     }
     int bestmove = get_best_move(passflag);
     return bestmove;
@@ -418,13 +545,14 @@ void UCTSearch::ponder() {
     assert(m_nodes == 0);
 
     m_run = true;
+    SearchStats::get_thread_stats().start();
     int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
         tg.add_task(UCTWorker(m_rootstate, this, &m_root));
     }
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
+        auto currstate = copy_state(m_rootstate);
         auto result = play_simulation(*currstate, &m_root);
         if (result.valid()) {
             increment_playouts();
@@ -433,7 +561,9 @@ void UCTSearch::ponder() {
 
     // stop the search
     m_run = false;
+    collect_stats();
     tg.wait_all();
+    s_last_stats = m_thread_stats;
     // display search info
     myprintf("\n");
     dump_stats(m_rootstate, m_root);
@@ -19,11 +19,17 @@
 #ifndef UCTSEARCH_H_INCLUDED
 #define UCTSEARCH_H_INCLUDED
 
+#include <array>
+#include <chrono>
 #include <memory>
 #include <atomic>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include "GameState.h"
+#include "SMP.h"
+#include "TTable.h"
 #include "UCTNode.h"
 
 class SearchResult {
@@ -50,6 +56,51 @@ private:
     float m_eval{0.0f};
 };
 
+/*
+    Time spent per phase of a playout. Every search thread fills its
+    own thread local copy and hands it to the search when it stops,
+    so nothing is shared between threads while searching.
+*/
+class SearchStats {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum phase_t : int {
+        STATE_COPY = 0, TT_ACCESS, SELECT, PLAY_MOVE, SUPERKO,
+        NN_EVAL, EXPAND, SCORE, BACKUP, NUM_PHASES
+    };
+
+    /*
+        charges the lifetime of the timer to a phase
+    */
+    class Timer {
+    public:
+        explicit Timer(phase_t phase)
+            : m_phase(phase), m_start(clock::now()) {}
+        ~Timer() {
+            get_thread_stats().add(m_phase, clock::now() - m_start);
+        }
+    private:
+        phase_t m_phase;
+        clock::time_point m_start;
+    };
+
+    static SearchStats& get_thread_stats();
+    static std::string report(const std::vector<SearchStats>& threads);
+
+    void start();
+    void stop();
+    void add(phase_t phase, clock::duration elapsed);
+    void add_playout();
+
+private:
+    std::array<clock::duration, NUM_PHASES> m_time{};
+    std::array<uint64, NUM_PHASES> m_calls{};
+    clock::time_point m_start;
+    clock::duration m_wall{};
+    int m_playouts{0};
+};
+
 class UCTSearch {
 public:
     /*
@@ -68,7 +119,7 @@ public:
     */
     static constexpr auto MAX_TREE_SIZE = 40'000'000;
 
-    UCTSearch(GameState & g);
+    UCTSearch(GameState & g, TTable & ttable = *TTable::get_TT());
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_analyzing(bool flag);
@@ -77,8 +128,16 @@ public:
     bool is_running() const;
     bool playout_limit_reached() const;
     void increment_playouts();
+    int get_playouts() const;
+    int get_nodes() const;
+    void collect_stats();
     SearchResult play_simulation(GameState & currstate, UCTNode * const node);
 
+    /*
+        phase timings of the last finished search on this thread
+    */
+    static std::string get_last_stats();
+
 private:
     void dump_stats(KoState & state, UCTNode & parent);
     std::string get_pv(KoState & state, UCTNode & parent);
@@ -86,11 +145,16 @@ private:
     int get_best_move(passflag_t passflag);
 
     GameState & m_rootstate;
+    TTable & m_ttable;
     UCTNode m_root{FastBoard::PASS, 0.0f};
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
     int m_maxplayouts;
+
+    SMP::Mutex m_stats_mutex;
+    std::vector<SearchStats> m_thread_stats;
+    static thread_local std::vector<SearchStats> s_last_stats;
 };
 
 class UCTWorker {
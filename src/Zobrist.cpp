@@ -24,6 +24,7 @@
 std::array<std::array<uint64, FastBoard::MAXSQ>,     4> Zobrist::zobrist;
 std::array<std::array<uint64, FastBoard::MAXSQ * 2>, 2> Zobrist::zobrist_pris;
 std::array<uint64, 5>                                   Zobrist::zobrist_pass;
+std::array<Zobrist::SymTable, FastBoard::MAXBOARDSIZE + 1> Zobrist::zobrist_sym;
 
 void Zobrist::init_zobrist(Random & rng) {
     for (int i = 0; i < 4; i++) {
@@ -44,4 +45,24 @@ void Zobrist::init_zobrist(Random & rng) {
         Zobrist::zobrist_pass[i]  = ((uint64)rng.randuint32()) << 32;
         Zobrist::zobrist_pass[i] ^= (uint64)rng.randuint32();
     }
+
+    // The rotations depend on the board size, so build the
+    // symmetric keys for every size we support.
+    for (int size = 1; size <= FastBoard::MAXBOARDSIZE; size++) {
+        FastBoard board;
+        board.reset_board(size);
+
+        for (int sym = 0; sym < 8; sym++) {
+            for (int i = 0; i < size; i++) {
+                for (int j = 0; j < size; j++) {
+                    int vertex = board.get_vertex(i, j);
+                    int newvtx = board.rotate_vertex(vertex, sym);
+                    for (int c = 0; c < 3; c++) {
+                        Zobrist::zobrist_sym[size][sym][c][vertex] =
+                            Zobrist::zobrist[c][newvtx];
+                    }
+                }
+            }
+        }
+    }
 }
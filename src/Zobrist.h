@@ -29,6 +29,14 @@ public:
     static std::array<std::array<uint64, FastBoard::MAXSQ * 2>, 2> zobrist_pris;
     static std::array<uint64, 5>                                   zobrist_pass;
 
+    /*
+        keys of the rotated vertex for each board size and symmetry,
+        so the 8 symmetric hashes can be updated incrementally
+    */
+    using SymTable = std::array<std::array<std::array<uint64,
+                                FastBoard::MAXSQ>, 3>, 8>;
+    static std::array<SymTable, FastBoard::MAXBOARDSIZE + 1>       zobrist_sym;
+
     static void init_zobrist(Random & rng);
 };
 
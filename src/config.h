@@ -35,7 +35,12 @@
 #define USE_BLAS
 #define USE_OPENBLAS
 //#define USE_MKL
+/* Without OpenCL the whole network is evaluated with BLAS on the CPU.
+ * Compile with -DUSE_CPU_ONLY for such a build.
+ */
+#ifndef USE_CPU_ONLY
 #define USE_OPENCL
+#endif
 //#define USE_TUNER
 
 #define PROGRAM_NAME "Leela Zero"
@@ -0,0 +1,184 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "ChunkLoader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "Network.h"
+
+ChunkLoader::ChunkLoader(const std::vector<std::string>& chunks,
+                         size_t shuffle_size, int threads, int seed)
+    : m_chunks(chunks),
+      m_shuffle_size(std::max(shuffle_size, size_t{1})),
+      m_seed(seed),
+      m_rng(seed) {
+    if (m_chunks.empty()) {
+        throw std::invalid_argument("No training chunks given");
+    }
+    for (auto symmetry = 0; symmetry < 8; symmetry++) {
+        for (auto vertex = 0; vertex < 19 * 19; vertex++) {
+            m_rotation[symmetry][vertex] =
+                Network::rotate_nn_idx(vertex, symmetry);
+        }
+    }
+    m_buffer.reserve(m_shuffle_size);
+
+    // Every reader gets its own share of the chunks, so a pass over
+    // the data reads each chunk once.
+    m_reader_count = std::min(size_t(std::max(threads, 1)), m_chunks.size());
+    for (auto i = size_t{0}; i < m_reader_count; i++) {
+        m_readers.emplace_back(&ChunkLoader::reader_loop, this, i);
+    }
+}
+
+ChunkLoader::~ChunkLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_not_full.notify_all();
+    for (auto& reader : m_readers) {
+        reader.join();
+    }
+}
+
+void ChunkLoader::add_positions(std::vector<Position>& positions) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (auto& position : positions) {
+        if (m_buffer.size() >= m_shuffle_size) {
+            m_not_empty.notify_all();
+            m_not_full.wait(lock, [this]() {
+                return m_exit || m_buffer.size() < m_shuffle_size;
+            });
+        }
+        if (m_exit) {
+            return;
+        }
+        m_buffer.emplace_back(std::move(position));
+    }
+    m_not_empty.notify_all();
+}
+
+void ChunkLoader::reader_done() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_readers_done++;
+    // Readers that have data never finish, so if they all did, they
+    // couldn't find any.
+    if (m_readers_done == m_reader_count && !m_error) {
+        m_error = std::make_exception_ptr(
+            std::runtime_error("No usable positions in the chunks"));
+    }
+    m_not_empty.notify_all();
+}
+
+void ChunkLoader::reader_loop(size_t thread_index) {
+    auto rng = Random{m_seed == -1 ? -1 : m_seed + 1 + int(thread_index)};
+    auto chunks = std::vector<std::string>{};
+    for (auto i = thread_index; i < m_chunks.size(); i += m_reader_count) {
+        chunks.emplace_back(m_chunks[i]);
+    }
+
+    auto positions = std::vector<Position>{};
+    for (;;) {
+        std::shuffle(begin(chunks), end(chunks), rng);
+        auto found = size_t{0};
+        for (const auto& chunk : chunks) {
+            positions.clear();
+            try {
+                found += ChunkFormat::decode_chunk(
+                    ChunkFormat::read_chunk(chunk), positions);
+            } catch (const std::exception& e) {
+                std::cerr << "Skipping " << chunk << ": "
+                          << e.what() << std::endl;
+                continue;
+            }
+            add_positions(positions);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_exit) {
+                return;
+            }
+        }
+        if (!found) {
+            reader_done();
+            return;
+        }
+    }
+}
+
+void ChunkLoader::expand(const Position& position, int symmetry,
+                         float* planes, float* probabilities,
+                         float* winner) const {
+    const auto& rotate = m_rotation[symmetry];
+    for (auto p = size_t{0}; p < HISTORY_PLANES; p++) {
+        auto bits = &position.planes[p * PLANE_BYTES];
+        auto plane = planes + p * BOARD_SQUARES;
+        for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+            auto vertex = rotate[idx];
+            plane[idx] = float((bits[vertex >> 3] >> (vertex & 7)) & 1);
+        }
+    }
+    // Side to move planes
+    auto black_to_move = (position.to_move == 0 ? 1.0f : 0.0f);
+    std::fill_n(planes + 16 * BOARD_SQUARES, BOARD_SQUARES, black_to_move);
+    std::fill_n(planes + 17 * BOARD_SQUARES, BOARD_SQUARES,
+                1.0f - black_to_move);
+    for (auto idx = size_t{0}; idx < BOARD_SQUARES; idx++) {
+        probabilities[idx] = position.probabilities[rotate[idx]];
+    }
+    // Pass stays where it is
+    probabilities[BOARD_SQUARES] = position.probabilities[BOARD_SQUARES];
+    *winner = float(position.winner);
+}
+
+void ChunkLoader::next_batch(size_t batch_size, float* planes,
+                             float* probabilities, float* winners) {
+    if (batch_size > m_shuffle_size) {
+        throw std::invalid_argument("Batch is larger than the shuffle buffer");
+    }
+    auto batch = std::vector<Position>{};
+    auto symmetries = std::vector<int>{};
+    batch.reserve(batch_size);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto min_fill = std::max(batch_size, m_shuffle_size / 2);
+        m_not_empty.wait(lock, [this, min_fill]() {
+            return m_error || m_buffer.size() >= min_fill;
+        });
+        if (m_error) {
+            std::rethrow_exception(m_error);
+        }
+        for (auto i = size_t{0}; i < batch_size; i++) {
+            auto pick = m_rng.randuint32(uint32(m_buffer.size()));
+            batch.emplace_back(std::move(m_buffer[pick]));
+            m_buffer[pick] = std::move(m_buffer.back());
+            m_buffer.pop_back();
+            symmetries.emplace_back(m_rng.randfix<8>());
+        }
+    }
+    m_not_full.notify_all();
+
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        expand(batch[i], symmetries[i],
+               planes + i * INPUT_PLANES * BOARD_SQUARES,
+               probabilities + i * POLICY_OUTPUTS,
+               winners + i);
+    }
+}
@@ -0,0 +1,96 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKLOADER_H_INCLUDED
+#define CHUNKLOADER_H_INCLUDED
+
+#include "config.h"
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ChunkFormat.h"
+#include "Random.h"
+
+/*
+    Reads training chunks as written by OutputChunker, text or binary,
+    on a number of threads and feeds them through a shuffle buffer.
+    Every position handed out gets a random one of the 8 board
+    symmetries and is expanded into the float tensors the training
+    takes: 18 input planes of 361 points, 362 search probabilities and
+    the game result for the side to move.
+
+    The readers go over the chunks in a new random order on every pass
+    and never stop, like training/tf/parse.py does.
+*/
+class ChunkLoader {
+public:
+    static constexpr size_t INPUT_PLANES = 18;
+    static constexpr size_t BOARD_SQUARES = 19 * 19;
+    static constexpr size_t POLICY_OUTPUTS = ChunkFormat::POLICY_OUTPUTS;
+
+    // A seed of -1 seeds from the time.
+    ChunkLoader(const std::vector<std::string>& chunks,
+                size_t shuffle_size, int threads, int seed = -1);
+    ~ChunkLoader();
+
+    /*
+        Fill planes[batch_size][INPUT_PLANES][BOARD_SQUARES],
+        probabilities[batch_size][POLICY_OUTPUTS] and
+        winners[batch_size]. Waits until the shuffle buffer is at least
+        half full.
+    */
+    void next_batch(size_t batch_size, float* planes,
+                    float* probabilities, float* winners);
+
+private:
+    static constexpr size_t HISTORY_PLANES = ChunkFormat::HISTORY_PLANES;
+    static constexpr size_t PLANE_BYTES = ChunkFormat::PLANE_BYTES;
+
+    // A position as kept in the shuffle buffer
+    using Position = ChunkFormat::Record;
+
+    void reader_loop(size_t thread_index);
+    void reader_done();
+    void add_positions(std::vector<Position>& positions);
+    void expand(const Position& position, int symmetry,
+                float* planes, float* probabilities, float* winner) const;
+
+    std::vector<std::string> m_chunks;
+    size_t m_shuffle_size;
+    int m_seed;
+    std::array<std::array<int, BOARD_SQUARES>, 8> m_rotation;
+
+    // The shuffle buffer, guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+    std::vector<Position> m_buffer;
+    Random m_rng;
+    bool m_exit{false};
+    size_t m_readers_done{0};
+    std::exception_ptr m_error;
+
+    size_t m_reader_count;
+    std::vector<std::thread> m_readers;
+};
+
+#endif
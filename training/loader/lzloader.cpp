@@ -0,0 +1,63 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "config.h"
+#include "lzloader.h"
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "ChunkLoader.h"
+
+struct lz_loader {
+    ChunkLoader loader;
+};
+
+static thread_local std::string s_error;
+
+lz_loader* lz_loader_create(const char* const* chunks, size_t chunk_count,
+                            size_t shuffle_size, int threads, int seed) {
+    try {
+        auto files = std::vector<std::string>(chunks, chunks + chunk_count);
+        return new lz_loader{{files, shuffle_size, threads, seed}};
+    } catch (const std::exception& e) {
+        s_error = e.what();
+        return nullptr;
+    }
+}
+
+int lz_loader_next_batch(lz_loader* loader, size_t batch_size,
+                         float* planes, float* probabilities,
+                         float* winners) {
+    try {
+        loader->loader.next_batch(batch_size, planes, probabilities, winners);
+        return 1;
+    } catch (const std::exception& e) {
+        s_error = e.what();
+        return 0;
+    }
+}
+
+void lz_loader_destroy(lz_loader* loader) {
+    delete loader;
+}
+
+const char* lz_loader_error(void) {
+    return s_error.c_str();
+}
@@ -0,0 +1,70 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017 Gian-Carlo Pascutto
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef LZLOADER_H_INCLUDED
+#define LZLOADER_H_INCLUDED
+
+/*
+    C interface to ChunkLoader, for use from Python through ctypes.
+    Functions that can fail return 0 or NULL, after which
+    lz_loader_error() says what went wrong.
+*/
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#define LZLOADER_API __declspec(dllexport)
+#else
+#define LZLOADER_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lz_loader lz_loader;
+
+/*
+    Start reading the given chunk files with the given number of
+    threads, keeping up to shuffle_size positions in memory. A seed of
+    -1 seeds from the time.
+*/
+LZLOADER_API lz_loader* lz_loader_create(const char* const* chunks,
+                                         size_t chunk_count,
+                                         size_t shuffle_size,
+                                         int threads, int seed);
+
+/*
+    Fill planes[batch_size][18][361], probabilities[batch_size][362]
+    and winners[batch_size]. Blocks until enough data has been read.
+*/
+LZLOADER_API int lz_loader_next_batch(lz_loader* loader, size_t batch_size,
+                                      float* planes, float* probabilities,
+                                      float* winners);
+
+LZLOADER_API void lz_loader_destroy(lz_loader* loader);
+
+// The reason of the last failure on this thread
+LZLOADER_API const char* lz_loader_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
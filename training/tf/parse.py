@@ -16,11 +16,13 @@
 #    You should have received a copy of the GNU General Public License
 #    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
 
+import os
 import sys
 import glob
 import gzip
 import random
 import math
+import struct
 import multiprocessing as mp
 import tensorflow as tf
 from tfprocess import TFProcess
@@ -28,7 +30,14 @@ from tfprocess import TFProcess
 # 16 planes, 1 stm, 1 x 362 probs, 1 winner = 19 lines
 DATA_ITEM_LINES = 16 + 1 + 1 + 1
 
+# Binary chunks, see src/ChunkFormat.h
+BINARY_MAGIC = b"LZTB"
+BINARY_VERSION = 1
+BINARY_HEADER_SIZE = 12
+PLANE_BYTES = 46
+
 BATCH_SIZE = 256
+SHUFFLE_SIZE = 65536
 
 def remap_vertex(vertex, symmetry):
     """
@@ -109,6 +118,46 @@ def convert_train_data(text_item):
     sym_probabilities = apply_symmetry(probabilities, symmetry)
     return True, (sym_planes, sym_probabilities, [winner])
 
+def convert_binary_data(record):
+    """
+        Convert a binary training record to python lists, like
+        convert_train_data.
+    """
+    planes = []
+    for plane in range(0, 16):
+        offset = plane * PLANE_BYTES
+        planes.append([float((record[offset + (vertex >> 3)] >> (vertex & 7)) & 1)
+                       for vertex in range(361)])
+    offset = 16 * PLANE_BYTES
+    stm = record[offset]
+    assert stm == 0 or stm == 1
+    if stm == 0:
+        planes.append([1.0] * 361)
+        planes.append([0.0] * 361)
+    else:
+        planes.append([0.0] * 361)
+        planes.append([1.0] * 361)
+    winner = float(struct.unpack_from('b', record, offset + 1)[0])
+    assert winner == 1.0 or winner == -1.0
+    probabilities = [prob / 65535.0
+                     for prob in struct.unpack_from('<362H', record, offset + 2)]
+    # Get one of 8 symmetries
+    symmetry = random.randrange(8)
+    sym_planes = [apply_symmetry(plane, symmetry) for plane in planes]
+    sym_probabilities = apply_symmetry(probabilities, symmetry)
+    return True, (sym_planes, sym_probabilities, [winner])
+
+def binary_items(file_content):
+    """
+        Split the contents of a binary chunk into records.
+    """
+    version, record_size = struct.unpack_from('<II', file_content, 4)
+    assert version == BINARY_VERSION
+    item_count = (len(file_content) - BINARY_HEADER_SIZE) // record_size
+    for item_idx in range(item_count):
+        pick_offset = BINARY_HEADER_SIZE + item_idx * record_size
+        yield file_content[pick_offset:pick_offset + record_size]
+
 class ChunkParser:
     def __init__(self, chunks):
         self.queue = mp.Queue(4096)
@@ -124,6 +173,12 @@ class ChunkParser:
             random.shuffle(chunks)
             for chunk in chunks:
                 with gzip.open(chunk, 'r') as chunk_file:
+                    if chunk_file.peek(4)[:4] == BINARY_MAGIC:
+                        for item in binary_items(chunk_file.read()):
+                            success, data = convert_binary_data(item)
+                            if success:
+                                queue.put(data)
+                        continue
                     file_content = chunk_file.readlines()
                     item_count = len(file_content) // DATA_ITEM_LINES
                     for item_idx in range(item_count):
@@ -138,6 +193,48 @@ class ChunkParser:
         while True:
             yield self.queue.get()
 
+class NativeChunkParser:
+    """
+        Reads the chunks with the C++ loader from training/loader, which
+        CMake builds as the lzloader library, and yields whole batches.
+    """
+    def __init__(self, library, chunks, batch_size):
+        import ctypes
+        import numpy as np
+        self.ctypes = ctypes
+        self.np = np
+        self.batch_size = batch_size
+        self.lib = ctypes.CDLL(library)
+        self.lib.lz_loader_create.restype = ctypes.c_void_p
+        self.lib.lz_loader_error.restype = ctypes.c_char_p
+        chunk_names = (ctypes.c_char_p * len(chunks))(
+            *[chunk.encode() for chunk in chunks])
+        workers = max(1, mp.cpu_count() - 1)
+        print("Using {} loader threads.".format(workers))
+        self.loader = self.lib.lz_loader_create(
+            chunk_names, ctypes.c_size_t(len(chunks)),
+            ctypes.c_size_t(SHUFFLE_SIZE), workers, -1)
+        if not self.loader:
+            raise RuntimeError(self.lib.lz_loader_error().decode())
+
+    def parse_batch(self):
+        float_p = self.ctypes.POINTER(self.ctypes.c_float)
+        while True:
+            planes = self.np.empty((self.batch_size, 18, 19 * 19),
+                                   dtype=self.np.float32)
+            probs = self.np.empty((self.batch_size, 19 * 19 + 1),
+                                  dtype=self.np.float32)
+            winner = self.np.empty((self.batch_size, 1),
+                                   dtype=self.np.float32)
+            if not self.lib.lz_loader_next_batch(
+                    self.ctypes.c_void_p(self.loader),
+                    self.ctypes.c_size_t(self.batch_size),
+                    planes.ctypes.data_as(float_p),
+                    probs.ctypes.data_as(float_p),
+                    winner.ctypes.data_as(float_p)):
+                raise RuntimeError(self.lib.lz_loader_error().decode())
+            yield planes, probs, winner
+
 def get_chunks(data_prefix):
     return glob.glob(data_prefix + "*.gz")
 
@@ -150,12 +247,23 @@ def main(args):
     if not chunks:
         return
 
-    parser = ChunkParser(chunks)
-
-    dataset = tf.data.Dataset.from_generator(
-        parser.parse_chunk, output_types=(tf.float32, tf.float32, tf.float32))
-    dataset = dataset.shuffle(65536)
-    dataset = dataset.batch(BATCH_SIZE)
+    # The C++ loader does the shuffling and batching itself
+    loader_library = os.environ.get("LEELAZ_LOADER")
+    if loader_library:
+        parser = NativeChunkParser(loader_library, chunks, BATCH_SIZE)
+        dataset = tf.data.Dataset.from_generator(
+            parser.parse_batch,
+            output_types=(tf.float32, tf.float32, tf.float32),
+            output_shapes=(tf.TensorShape([BATCH_SIZE, 18, 19 * 19]),
+                           tf.TensorShape([BATCH_SIZE, 19 * 19 + 1]),
+                           tf.TensorShape([BATCH_SIZE, 1])))
+    else:
+        parser = ChunkParser(chunks)
+        dataset = tf.data.Dataset.from_generator(
+            parser.parse_chunk,
+            output_types=(tf.float32, tf.float32, tf.float32))
+        dataset = dataset.shuffle(SHUFFLE_SIZE)
+        dataset = dataset.batch(BATCH_SIZE)
     dataset = dataset.prefetch(16)
     iterator = dataset.make_one_shot_iterator()
     next_batch = iterator.get_next()